@@ -0,0 +1,448 @@
+/*! \file */
+
+#include "stdafx.h"
+#include "tools.h"
+#include "TrainingSet.h"
+#include "ErcForest.h"
+#include "Classifier.h"
+#include "CompactForest.h"
+#include "ModelHandle.h"
+#include "BatchClassifier.h"
+#include "IncrementalScorer.h"
+#include "Localizer.h"
+#include "FeatureExtractor.h"
+#include "SyntheticData.h"
+
+using namespace ercf;
+
+static atomic<long long> allocatedBytes(0);
+
+void *operator new(size_t size)
+{
+	allocatedBytes += size;
+	void *p = malloc(size);
+	if (p == NULL) throw bad_alloc();
+	return p;
+}
+
+void operator delete(void *p)
+{
+	free(p);
+}
+
+void *operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete[](void *p)
+{
+	operator delete(p);
+}
+
+/*! Receives the results of the measured calls, so that the optimizer cannot remove a call whose result is otherwise unused. */
+static volatile unsigned char resultSink;
+
+template<typename T>
+inline void doNotOptimize(const T &value)
+{
+	resultSink = *(const volatile unsigned char *)&value;
+}
+
+struct Result
+{
+	string name;
+	unsigned long long nOps;
+	double nsPerOp;
+	double bytesPerOp;
+};
+
+class Benchmark
+{
+public:
+	Benchmark(double minSeconds, string filter) : _minSeconds(minSeconds), _filter(filter)
+	{
+	}
+
+	template<class Op>
+	void run(string name, Op op)
+	{
+		if (_filter.size() != 0 && name.find(_filter) == string::npos) return;
+
+		op();
+		unsigned long long nOps = 0;
+		unsigned long long batch = 1;
+		long long bytes = allocatedBytes;
+		long long start = Trace::now();
+		long long elapsed = 0;
+		while (elapsed < _minSeconds * 1e9)
+		{
+			for (unsigned long long i = 0; i < batch; ++i) op();
+			nOps += batch;
+			batch *= 2;
+			elapsed = Trace::now() - start;
+		}
+		bytes = allocatedBytes - bytes;
+
+		Result result = {name, nOps, elapsed / (double)nOps, bytes / (double)nOps};
+		_results.push_back(result);
+		cout << left << setw(36) << name << right << setw(12) << nOps << fixed << setprecision(1) << setw(16) << result.nsPerOp << setw(16) << result.bytesPerOp << endl;
+		cout.unsetf(ios::fixed);
+	}
+
+	void save(string file) const
+	{
+		ofstream output;
+		output.open(file.c_str(), ios::trunc);
+		for (unsigned int i = 0; i < _results.size(); ++i)
+		{
+			output << _results[i].name << " " << _results[i].nsPerOp << " " << _results[i].bytesPerOp << endl;
+		}
+		output.close();
+	}
+
+	unsigned int compare(string file, double threshold) const
+	{
+		map<string, pair<double, double>> baseline;
+		ifstream input(file.c_str());
+		string name;
+		double ns, bytes;
+		while (input >> name >> ns >> bytes)
+		{
+			baseline[name] = make_pair(ns, bytes);
+		}
+
+		unsigned int nRegressions = 0;
+		for (unsigned int i = 0; i < _results.size(); ++i)
+		{
+			map<string, pair<double, double>>::const_iterator it = baseline.find(_results[i].name);
+			if (it == baseline.end()) continue;
+			double timeRatio = _results[i].nsPerOp / it->second.first;
+			bool timeRegression = timeRatio > 1. + threshold;
+			bool memoryRegression = _results[i].bytesPerOp > it->second.second * (1. + threshold) + 1.;
+			if (timeRegression || memoryRegression)
+			{
+				cout << "REGRESSION " << _results[i].name << ": " << it->second.first << " -> " << _results[i].nsPerOp << " ns/op, " << it->second.second << " -> " << _results[i].bytesPerOp << " bytes/op" << endl;
+				++nRegressions;
+			}
+		}
+		return nRegressions;
+	}
+
+private:
+	double _minSeconds;
+	string _filter;
+	vector<Result> _results;
+};
+
+/*! The tree has no project for ErcfBench.exe: it is built from this directory and the sources of ercf/code except ERCF.cpp, with 
+ *  the include paths and libraries of ERCF.exe. */
+int main(unsigned int argc, char* argv[])
+{
+	string saveFile;
+	string compareFile;
+	string filter;
+	double threshold = 0.1;
+	double minSeconds = 0.5;
+	for (unsigned int a = 1; a < argc; ++a)
+	{
+		string arg = argv[a];
+		if (arg == "--save" && a + 1 < argc) saveFile = argv[++a];
+		else if (arg == "--compare" && a + 1 < argc) compareFile = argv[++a];
+		else if (arg == "--threshold" && a + 1 < argc) threshold = atof(argv[++a]);
+		else if (arg == "--filter" && a + 1 < argc) filter = argv[++a];
+		else if (arg == "--time" && a + 1 < argc) minSeconds = atof(argv[++a]);
+		else
+		{
+			cout << "Usage" << endl << endl;
+			cout << "ErcfBench.exe [--filter name] [--time seconds] [--save baseline.txt] [--compare baseline.txt] [--threshold 0.1]" << endl;
+			return 0;
+		}
+	}
+
+	SyntheticData data;
+	Benchmark benchmark(minSeconds, filter);
+	unsigned int featureDim = 768;
+	unsigned int nLabels = 4;
+	unsigned int nPoints = 20000;
+
+	cout << left << setw(36) << "benchmark" << right << setw(12) << "ops" << setw(16) << "ns/op" << setw(16) << "bytes/op" << endl;
+
+	CImg<double> features;
+	vector<unsigned int> labels;
+	data.features(features, labels, nPoints, featureDim, nLabels);
+	TrainingSet set(&features, &labels, nLabels);
+	TrainingSet set1(set);
+	TrainingSet set2(set);
+
+	benchmark.run("TrainingSet::partition", [&]()
+	{
+		set.partition(data.uniform(featureDim), data.uniform(), set1, set2);
+	});
+
+	double entropy = set.getLabelEntropy();
+	benchmark.run("split scoring", [&]()
+	{
+		set.partition(data.uniform(featureDim), data.uniform(), set1, set2);
+		doNotOptimize(ErcTree::getPartitionScore(entropy, TrainingSet::getPartitionEntropy(set1, set2), TrainingSet::getLabelPartitionJointEntropy(set1, set2)));
+	});
+
+	unsigned int testFeatureIndices[ErcTree::splitBatchSize];
+	double testThresholds[ErcTree::splitBatchSize];
+	vector<unsigned int> labelSetOccurences(ErcTree::splitBatchSize * 2 * nLabels);
+	benchmark.run("evaluateSplits (8 candidates)", [&]()
+	{
+		for (unsigned int k = 0; k < ErcTree::splitBatchSize; ++k)
+		{
+			testFeatureIndices[k] = data.uniform(featureDim);
+			testThresholds[k] = data.uniform();
+		}
+		set.evaluateSplits(testFeatureIndices, testThresholds, ErcTree::splitBatchSize, labelSetOccurences.data());
+	});
+
+	benchmark.run("ErcTree::getPartitionScore (8 candidates, from counts)", [&]()
+	{
+		for (unsigned int k = 0; k < ErcTree::splitBatchSize; ++k)
+		{
+			doNotOptimize(ErcTree::getPartitionScore(entropy, labelSetOccurences.data() + k * 2 * nLabels, nLabels));
+		}
+	});
+
+	TrainingSet sample(set);
+	benchmark.run("TrainingSet::sample (2000 points)", [&]()
+	{
+		set.sample(2000, sample);
+	});
+
+	benchmark.run("evaluateSplits (8 candidates, 2000 sampled points)", [&]()
+	{
+		for (unsigned int k = 0; k < ErcTree::splitBatchSize; ++k)
+		{
+			testFeatureIndices[k] = data.uniform(featureDim);
+			testThresholds[k] = data.uniform();
+		}
+		sample.evaluateSplits(testFeatureIndices, testThresholds, ErcTree::splitBatchSize, labelSetOccurences.data());
+	});
+
+	CImg<unsigned char> byteFeatures(features.width(), features.height());
+	for (unsigned int i = 0; i < features.width() * features.height(); ++i) byteFeatures[i] = (unsigned char)(255. * features[i]);
+	TrainingSet byteSet(&byteFeatures, &labels, nLabels);
+	TrainingSet byteSet1(byteSet);
+	TrainingSet byteSet2(byteSet);
+	benchmark.run("TrainingSet::partition (uint8)", [&]()
+	{
+		byteSet.partition(data.uniform(featureDim), ceil(255. * data.uniform()), byteSet1, byteSet2);
+	});
+
+	benchmark.run("evaluateSplits (8 candidates, uint8)", [&]()
+	{
+		for (unsigned int k = 0; k < ErcTree::splitBatchSize; ++k)
+		{
+			testFeatureIndices[k] = data.uniform(featureDim);
+			testThresholds[k] = ceil(255. * data.uniform());
+		}
+		byteSet.evaluateSplits(testFeatureIndices, testThresholds, ErcTree::splitBatchSize, labelSetOccurences.data());
+	});
+
+	TrainingSet binnedSet(&features, &labels, nLabels);
+	binnedSet.setNBins(64);
+	TrainingSet binnedSet1(binnedSet);
+	TrainingSet binnedSet2(binnedSet);
+	benchmark.run("partition + getHistogram", [&]()
+	{
+		binnedSet.partition(data.uniform(featureDim), data.uniform(), binnedSet1, binnedSet2);
+		binnedSet1.getHistogram(data.uniform(featureDim));
+	});
+
+	data.saveForest("bench_forest.xml", 5, 16, 1000, featureDim, nLabels);
+	ErcForest forest("bench_forest.xml");
+	vector<CImg<double>> columns(256);
+	for (unsigned int i = 0; i < columns.size(); ++i) columns[i] = features.get_column(i);
+
+	TiXmlDocument doc("bench_forest.xml");
+	doc.LoadFile();
+	ErcTree tree;
+	tree.assign(doc.FirstChildElement("forest")->FirstChildElement());
+	unsigned int column = 0;
+	benchmark.run("ErcTree::test", [&]()
+	{
+		doNotOptimize(tree.test(columns[column++ % columns.size()]));
+	});
+
+	vector<double> histogram(forest.getNLeaves() + 1, 0.);
+	benchmark.run("ErcForest::classify", [&]()
+	{
+		forest.classify(histogram.data(), columns[column++ % columns.size()]);
+	});
+
+	CompactForest compactForest(forest);
+	vector<unsigned short> quantized(compactForest.getFeatureDim() * columns.size());
+	for (unsigned int i = 0; i < columns.size(); ++i) compactForest.quantize(quantized.data() + i * compactForest.getFeatureDim(), columns[i]);
+	benchmark.run("CompactForest::classify (quantized)", [&]()
+	{
+		compactForest.classify(histogram.data(), quantized.data() + (column++ % columns.size()) * compactForest.getFeatureDim());
+	});
+
+	benchmark.run("CompactForest::classify (double)", [&]()
+	{
+		compactForest.classify(histogram.data(), columns[column++ % columns.size()]);
+	});
+
+	data.saveModels("bench_classifier.bin", nLabels, forest.getNLeaves());
+	Classifier classifier(&forest);
+	classifier.load("bench_classifier.bin");
+	CImg<double> imageFeatures = features.get_columns(0, 999);
+	benchmark.run("Classifier::classify (1000 desc.)", [&]()
+	{
+		doNotOptimize(classifier.classify(imageFeatures, 0));
+	});
+
+	Classifier compactClassifier(&forest);
+	compactClassifier.load("bench_classifier.bin");
+	compactClassifier.setCompactForest(&compactForest);
+	benchmark.run("Classifier::classify (1000 desc., compact)", [&]()
+	{
+		doNotOptimize(compactClassifier.classify(imageFeatures, 0));
+	});
+
+	IncrementalScorer scorer(&classifier);
+	benchmark.run("IncrementalScorer::add + reset (1000 desc.)", [&]()
+	{
+		scorer.add(imageFeatures);
+		scorer.reset();
+	});
+
+	CImg<double> positions(imageFeatures.width(), 2);
+	cimg_forX(positions, i)
+	{
+		positions(i, 0) = data.uniform(640);
+		positions(i, 1) = data.uniform(480);
+	}
+	Localizer localizer(&classifier);
+	unsigned int box[4];
+	benchmark.run("Localizer::localize (1000 desc., 640x480)", [&]()
+	{
+		doNotOptimize(localizer.localize(imageFeatures, positions, 640, 480, 0, box));
+	});
+
+	double margin;
+	benchmark.run("Classifier::vote (1000 desc.)", [&]()
+	{
+		doNotOptimize(classifier.vote(imageFeatures, margin));
+	});
+
+	unsigned int batchSize = 16;
+	vector<const CImg<double> *> batch(batchSize, &imageFeatures);
+	CImg<double> scores;
+	benchmark.run("Classifier::classify (batch of 16 x 1000 desc., all labels)", [&]()
+	{
+		classifier.classify(batch, scores);
+	});
+
+	ModelHandle models;
+	models.load("bench_forest.xml", "bench_classifier.bin");
+	benchmark.run("ModelHandle::get", [&]()
+	{
+		doNotOptimize(models.get());
+	});
+
+	shared_ptr<const Model> model = models.get();
+	BatchClassifier batchClassifier(batchSize, 2000);
+	vector<future<vector<double>>> pendingScores(batchSize);
+	benchmark.run("BatchClassifier::classify (16 concurrent requests)", [&]()
+	{
+		for (unsigned int i = 0; i < batchSize; ++i) pendingScores[i] = batchClassifier.classify(model, imageFeatures);
+		for (unsigned int i = 0; i < batchSize; ++i) pendingScores[i].get();
+	});
+
+	unsigned int nImages = 4;
+	unsigned int maxNFeatures = 67;
+	CImgList<float> images(nImages);
+	vector<BitMask> masks(nImages);
+	for (unsigned int i = 0; i < nImages; ++i)
+	{
+		images[i] = data.hslImage(320, 240);
+		masks[i] = data.mask(320, 240);
+	}
+	CImgList<double> featureList(maxNFeatures);
+	vector<unsigned int> nDescriptorsPerImage(nImages);
+	FeatureExtractor extractor(&featureList, nDescriptorsPerImage.data(), maxNFeatures, &images);
+	FeatureExtractor maskedExtractor(&featureList, nDescriptorsPerImage.data(), maxNFeatures, &images, &masks);
+	unsigned int image = 0;
+	benchmark.run("FeatureExtractor::getHsl (67 desc.)", [&]()
+	{
+		extractor.getHsl(0, image++ % nImages, 16);
+	});
+	benchmark.run("FeatureExtractor::getHsl masked", [&]()
+	{
+		maskedExtractor.getHsl(0, image++ % nImages, 16);
+	});
+	benchmark.run("FeatureExtractor::getHslHaar", [&]()
+	{
+		extractor.getHslHaar(0, image++ % nImages, 16);
+	});
+	benchmark.run("FeatureExtractor::getSift", [&]()
+	{
+		extractor.getSift(0, image++ % nImages);
+	});
+
+	vector<double> progressiveScores;
+	benchmark.run("Classifier::classifyProgressive (HSL, batches of 50)", [&]()
+	{
+		DescriptorStream stream(images, image++ % nImages, 0, 1000, 16);
+		classifier.classifyProgressive(stream, 50, 1., 1., progressiveScores);
+	});
+
+	unsigned int maskPoint = 0;
+	benchmark.run("BitMask::countWithin + select", [&]()
+	{
+		const BitMask &mask = masks[maskPoint++ % nImages];
+		unsigned int n = mask.countWithin(mask.width() - 16, mask.height() - 16);
+		unsigned int x, y;
+		if (n > 0) mask.select(maskPoint % n, mask.width() - 16, mask.height() - 16, x, y);
+		doNotOptimize(n > 0 ? x + y : n);
+	});
+
+	unsigned int nPixels = 1 << 20;
+	vector<unsigned char> rgb(3 * nPixels);
+	for (unsigned int i = 0; i < rgb.size(); ++i) rgb[i] = data.uniform(256);
+	vector<float> hsl(3 * nPixels);
+	benchmark.run("rgbToHsl (1 Mpx)", [&]()
+	{
+		rgbToHsl(rgb.data(), rgb.data() + nPixels, rgb.data() + 2 * nPixels, hsl.data(), hsl.data() + nPixels, hsl.data() + 2 * nPixels, nPixels);
+	});
+
+	unsigned int listSize = 100000;
+	vector<unsigned int> keys(listSize);
+	for (unsigned int i = 0; i < listSize; ++i) keys[i] = data.uniform(1000);
+	benchmark.run("AssociativeSortedList::insert (1e5)", [&]()
+	{
+		AssociativeSortedList<unsigned int, unsigned int> list(listSize);
+		for (unsigned int i = 0; i < listSize; ++i) list.insert(keys[i], i);
+	});
+	AssociativeSortedList<unsigned int, unsigned int> list(listSize);
+	for (unsigned int i = 0; i < listSize; ++i) list.insert(keys[i], i);
+	unsigned int key = 0;
+	benchmark.run("AssociativeSortedList::lowerBound", [&]()
+	{
+		doNotOptimize(list.lowerBound(key++ % 1000));
+	});
+
+	benchmark.run("ErcForest::save", [&]()
+	{
+		forest.save("bench_forest_saved.xml");
+	});
+	benchmark.run("ErcForest load from XML", [&]()
+	{
+		ErcForest loaded("bench_forest_saved.xml");
+	});
+
+	if (saveFile.size() != 0) benchmark.save(saveFile);
+	if (compareFile.size() != 0)
+	{
+		unsigned int nRegressions = benchmark.compare(compareFile, threshold);
+		cout << nRegressions << " regression(s) beyond " << 100. * threshold << "%." << endl;
+		return (nRegressions == 0) ? 0 : 1;
+	}
+	return 0;
+}
@@ -0,0 +1,126 @@
+#include "stdafx.h"
+#include "SyntheticData.h"
+
+using namespace ercf;
+
+SyntheticData::SyntheticData(unsigned int seed) : _engine(seed)
+{
+}
+
+double SyntheticData::uniform(void)
+{
+	return (_engine() - _engine.min()) / (double)(_engine.max() - _engine.min());
+}
+
+unsigned int SyntheticData::uniform(unsigned int n)
+{
+	return min((unsigned int)(uniform() * n), n - 1);
+}
+
+void SyntheticData::features(CImg<double> &features, vector<unsigned int> &labels, unsigned int nPoints, unsigned int featureDim, unsigned int nLabels)
+{
+	CImg<double> centers(nLabels, featureDim);
+	cimg_forXY(centers, l, f) centers(l, f) = uniform();
+
+	features.assign(nPoints, featureDim);
+	labels.assign(nPoints, 0);
+	for (unsigned int p = 0; p < nPoints; ++p)
+	{
+		labels[p] = uniform(nLabels);
+		for (unsigned int f = 0; f < featureDim; ++f)
+		{
+			features(p, f) = centers(labels[p], f) + 0.5 * (uniform() - 0.5);
+		}
+	}
+}
+
+string SyntheticData::_treeXml(unsigned int depth, unsigned int nLeaves, unsigned int featureDim, unsigned int nLabels, unsigned int &leafIndex)
+{
+	stringstream output;
+	if (nLeaves <= 1 || depth == 0)
+	{
+		output << "<leaf index=\"" << leafIndex++ << "\" unmixed=\"" << (uniform() < 0.2) << "\" label=\"" << uniform(nLabels) << "\" posterior=\"";
+		vector<double> posterior(nLabels);
+		double total = 0.;
+		for (unsigned int l = 0; l < nLabels; ++l) total += (posterior[l] = uniform());
+		for (unsigned int l = 0; l < nLabels; ++l) output << ((l > 0) ? " " : "") << posterior[l] / total;
+		output << "\"/>";
+		return output.str();
+	}
+
+	unsigned int maxSubtreeLeaves = (depth > 31) ? nLeaves : min(nLeaves - 1, 1U << (depth - 1));
+	unsigned int minLeft = nLeaves - maxSubtreeLeaves;
+	unsigned int nLeft = minLeft + uniform(maxSubtreeLeaves - minLeft + 1);
+	nLeft = max(1U, min(nLeft, nLeaves - 1));
+
+	output << "<node score=\"" << uniform() << "\" testIndex=\"" << uniform(featureDim) << "\" testThreshold=\"" << uniform() << "\">";
+	output << _treeXml(depth - 1, nLeft, featureDim, nLabels, leafIndex);
+	output << _treeXml(depth - 1, nLeaves - nLeft, featureDim, nLabels, leafIndex);
+	output << "</node>";
+	return output.str();
+}
+
+string SyntheticData::forestXml(unsigned int nTrees, unsigned int depth, unsigned int nLeaves, unsigned int featureDim, unsigned int nLabels)
+{
+	if (depth < 32) nLeaves = min(nLeaves, 1U << depth);
+	stringstream output;
+	output << "<forest>";
+	for (unsigned int t = 0; t < nTrees; ++t)
+	{
+		unsigned int leafIndex = 0;
+		output << _treeXml(depth, nLeaves, featureDim, nLabels, leafIndex);
+	}
+	output << "</forest>";
+	return output.str();
+}
+
+void SyntheticData::saveForest(string xmlFile, unsigned int nTrees, unsigned int depth, unsigned int nLeaves, unsigned int featureDim, unsigned int nLabels)
+{
+	ofstream file;
+	file.open(xmlFile.c_str(), ios::trunc);
+	file << forestXml(nTrees, depth, nLeaves, featureDim, nLabels);
+	file.close();
+}
+
+void SyntheticData::saveModels(string binFile, unsigned int nModels, unsigned int nLeaves)
+{
+	CImg<double> models(nLeaves + 1, nModels);
+	cimg_forXY(models, x, y) models(x, y) = uniform() - 0.5;
+
+	ofstream bin;
+	bin.open(binFile.c_str(), ios::trunc | ios::binary);
+	bin.write((char *) &nModels, sizeof(unsigned int));
+	bin.write((char *) &nLeaves, sizeof(unsigned int));
+	bin.write((char *) models.data(), models.width() * models.height() * sizeof(double));
+	bin.close();
+}
+
+CImg<double> SyntheticData::hslImage(unsigned int width, unsigned int height)
+{
+	CImg<double> image(width, height, 1, 3);
+	double h0 = 360. * uniform();
+	double fx = 0.05 + 0.1 * uniform();
+	double fy = 0.05 + 0.1 * uniform();
+	cimg_forXY(image, x, y)
+	{
+		image(x, y, 0, 0) = fmod(h0 + 60. * sin(fx * x) * cos(fy * y) + 360., 360.);
+		image(x, y, 0, 1) = 0.5 + 0.4 * sin(fy * x + fx * y);
+		image(x, y, 0, 2) = min(1., max(0., 0.5 + 0.3 * cos(fx * x * y / (double)height) + 0.1 * (uniform() - 0.5)));
+	}
+	return image;
+}
+
+BitMask SyntheticData::mask(unsigned int width, unsigned int height)
+{
+	BitMask mask(width, height);
+	double cx = width * (0.3 + 0.4 * uniform());
+	double cy = height * (0.3 + 0.4 * uniform());
+	double rx = width * (0.2 + 0.2 * uniform());
+	double ry = height * (0.2 + 0.2 * uniform());
+	for (unsigned int y = 0; y < height; ++y)
+		for (unsigned int x = 0; x < width; ++x)
+		{
+			mask.set(x, y, square((x - cx) / rx) + square((y - cy) / ry) <= 1.);
+		}
+	return mask;
+}
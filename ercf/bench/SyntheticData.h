@@ -0,0 +1,27 @@
+/*! \file */
+
+#pragma once
+#include "stdafx.h"
+#include "tools.h"
+
+namespace ercf
+{
+	/*! Seeded generators for benchmark inputs. */
+	class SyntheticData
+	{
+	public:
+		SyntheticData(unsigned int seed = 999);
+		void features(CImg<double> &features, vector<unsigned int> &labels, unsigned int nPoints, unsigned int featureDim, unsigned int nLabels);
+		string forestXml(unsigned int nTrees, unsigned int depth, unsigned int nLeaves, unsigned int featureDim, unsigned int nLabels);
+		void saveForest(string xmlFile, unsigned int nTrees, unsigned int depth, unsigned int nLeaves, unsigned int featureDim, unsigned int nLabels);
+		void saveModels(string binFile, unsigned int nModels, unsigned int nLeaves);
+		CImg<double> hslImage(unsigned int width, unsigned int height);
+		BitMask mask(unsigned int width, unsigned int height);
+		double uniform(void);
+		unsigned int uniform(unsigned int n);
+
+	private:
+		string _treeXml(unsigned int depth, unsigned int nLeaves, unsigned int featureDim, unsigned int nLabels, unsigned int &leafIndex);
+		minstd_rand _engine;
+	};
+}
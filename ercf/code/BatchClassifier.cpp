@@ -0,0 +1,125 @@
+#include "stdafx.h"
+#include "BatchClassifier.h"
+
+using namespace ercf;
+
+BatchClassifier::BatchClassifier(unsigned int maxBatchSize, unsigned int maxDelay)
+	: _maxBatchSize(max(maxBatchSize, 1U)), _maxDelay(maxDelay), _isStopping(false)
+{
+	_worker = thread(&BatchClassifier::_work, this);
+}
+
+BatchClassifier::~BatchClassifier(void)
+{
+	{
+		lock_guard<mutex> lock(_requestsMutex);
+		_isStopping = true;
+	}
+	_requestsCondition.notify_all();
+	_worker.join();
+}
+
+future<vector<double>> BatchClassifier::classify(const shared_ptr<const Model> &model, const CImg<double> &features)
+{
+	Request *request = new Request;
+	request->model = model;
+	request->features = features;
+	future<vector<double>> scores = request->scores.get_future();
+	_push(request);
+	return scores;
+}
+
+void BatchClassifier::classify(const shared_ptr<const Model> &model, const CImg<double> &features, const Callback &callback)
+{
+	Request *request = new Request;
+	request->model = model;
+	request->features = features;
+	request->callback = callback;
+	_push(request);
+}
+
+void BatchClassifier::_push(Request *request)
+{
+	request->arrival = chrono::steady_clock::now();
+	bool isWaking;
+	{
+		lock_guard<mutex> lock(_requestsMutex);
+		_requests.push_back(request);
+		isWaking = _requests.size() == 1 || _requests.size() >= _maxBatchSize;
+	}
+	if (isWaking) _requestsCondition.notify_one();
+}
+
+void BatchClassifier::_work(void)
+{
+	vector<Request *> batch;
+	while (true)
+	{
+		{
+			unique_lock<mutex> lock(_requestsMutex);
+			_requestsCondition.wait(lock, [this]() { return _isStopping || !_requests.empty(); });
+			if (_requests.empty()) return;
+
+			// The oldest request bounds how long the batch may keep filling up
+			chrono::steady_clock::time_point deadline = _requests.front()->arrival + _maxDelay;
+			_requestsCondition.wait_until(lock, deadline, [this]() { return _isStopping || _requests.size() >= _maxBatchSize; });
+
+			while (!_requests.empty() && batch.size() < _maxBatchSize)
+			{
+				batch.push_back(_requests.front());
+				_requests.pop_front();
+			}
+		}
+		_process(batch);
+		batch.clear();
+	}
+}
+
+void BatchClassifier::_process(const vector<Request *> &batch)
+{
+	traceScope("batch");
+	Trace::counter("batch size", batch.size());
+
+	// Requests pinned to different models, around a model swap, are scored in one pass per model
+	vector<bool> isDone(batch.size(), false);
+	for (unsigned int first = 0; first < batch.size(); ++first)
+	{
+		if (isDone[first]) continue;
+		const Model *model = batch[first]->model.get();
+		vector<Request *> group;
+		vector<const CImg<double> *> featureList;
+		for (unsigned int i = first; i < batch.size(); ++i)
+		{
+			if (isDone[i] || batch[i]->model.get() != model) continue;
+			group.push_back(batch[i]);
+			featureList.push_back(&batch[i]->features);
+			isDone[i] = true;
+		}
+
+		// A failure, such as descriptors that do not match the model, fails the requests of the group instead of the worker thread
+		CImg<double> scores;
+		try
+		{
+			model->classifier.classify(featureList, scores);
+		}
+		catch (...)
+		{
+			exception_ptr error = current_exception();
+			for (unsigned int i = 0; i < group.size(); ++i)
+			{
+				if (group[i]->callback) group[i]->callback(vector<double>());
+				else group[i]->scores.set_exception(error);
+				delete group[i];
+			}
+			continue;
+		}
+
+		for (unsigned int i = 0; i < group.size(); ++i)
+		{
+			vector<double> imageScores(scores.data() + i * scores.width(), scores.data() + (i + 1) * scores.width());
+			if (group[i]->callback) group[i]->callback(imageScores);
+			else group[i]->scores.set_value(imageScores);
+			delete group[i];
+		}
+	}
+}
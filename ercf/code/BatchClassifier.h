@@ -0,0 +1,46 @@
+/*! \file */
+
+#pragma once
+#include "stdafx.h"
+#include "ModelHandle.h"
+
+namespace ercf
+{
+	/*! Asynchronous front-end of the classifiers of published models.
+	 *  Each request is scored by the model it was submitted with. Pending requests are coalesced into batches of at most maxBatchSize images, or whatever arrived within 
+	 *  maxDelay microseconds of the oldest one, and each batch is quantized and scored against all models in one pass.
+	 *  The result of a request is the vector of its decision functions, one per label. If its batch cannot be scored, the future 
+	 *  rethrows the error and the callback gets an empty vector. */
+	class BatchClassifier
+	{
+	public:
+		typedef function<void(const vector<double> &)> Callback;
+
+		BatchClassifier(unsigned int maxBatchSize, unsigned int maxDelay);
+		~BatchClassifier(void);
+		future<vector<double>> classify(const shared_ptr<const Model> &model, const CImg<double> &features);
+		void classify(const shared_ptr<const Model> &model, const CImg<double> &features, const Callback &callback);
+
+	private:
+		struct Request
+		{
+			shared_ptr<const Model> model;
+			CImg<double> features;
+			promise<vector<double>> scores;
+			Callback callback;
+			chrono::steady_clock::time_point arrival;
+		};
+
+		void _push(Request *request);
+		void _work(void);
+		void _process(const vector<Request *> &batch);
+
+		unsigned int _maxBatchSize;
+		chrono::microseconds _maxDelay;
+		deque<Request *> _requests;
+		mutex _requestsMutex;
+		condition_variable _requestsCondition;
+		bool _isStopping;
+		thread _worker;
+	};
+}
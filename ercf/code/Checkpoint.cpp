@@ -0,0 +1,300 @@
+#include "stdafx.h"
+#include "Checkpoint.h"
+
+using namespace ercf;
+
+/*! Tags the descriptor file, whose layout changes with this version. */
+static const unsigned int descriptorsVersion = 3;
+
+/*! Starts every file of trees, followed by treesVersion, so that a file of another kind or layout is not parsed as trees. */
+static const unsigned int treesMagic = 0x54435245;
+static const unsigned int treesVersion = 1;
+
+Checkpoint::Checkpoint(string directory) : _directory(directory)
+{
+	CreateDirectory(_directory.c_str(), NULL);
+}
+
+/*! Removes the stages of a previous training, which a new one must not resume from, whatever its number of trees or shards. */
+void Checkpoint::clear(void) const
+{
+	DeleteFile(_getPath("descriptors.bin").c_str());
+	_deleteFiles("tree*.bin");
+	_deleteFiles("shard*.bin");
+	_deleteFiles("*.tmp");
+	DeleteFile(_getPath("forest.bin").c_str());
+	DeleteFile(_getPath("models.bin").c_str());
+}
+
+/*! Deletes the files of the directory matching pattern. */
+void Checkpoint::_deleteFiles(const string &pattern) const
+{
+	WIN32_FIND_DATA findData;
+	HANDLE findHandle = FindFirstFile(_getPath(pattern).c_str(), &findData);
+	if (findHandle == INVALID_HANDLE_VALUE) return;
+	do
+	{
+		DeleteFile(_getPath(findData.cFileName).c_str());
+	}
+	while (FindNextFile(findHandle, &findData) != 0);
+	FindClose(findHandle);
+}
+
+string Checkpoint::_getPath(const string &name) const
+{
+	return _directory + "/" + name;
+}
+
+/*! Closes output, which wrote name.tmp, and replaces the stage file name by it, unless a write failed, in which case name.tmp is 
+ *  removed and the stage is left as it was. */
+bool Checkpoint::_commit(const string &name, ofstream &output) const
+{
+	output.flush();
+	bool isWritten = output.good();
+	output.close();
+	if (!isWritten || output.fail())
+	{
+		DeleteFile(_getPath(name + ".tmp").c_str());
+		cout << "Cannot write \"" << _getPath(name) << "\", the stage will be redone." << endl;
+		return false;
+	}
+	return _replace(name);
+}
+
+/*! Replaces the stage file name by name.tmp, once the rename reached the disk. */
+bool Checkpoint::_replace(const string &name) const
+{
+	return MoveFileEx(_getPath(name + ".tmp").c_str(), _getPath(name).c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+}
+
+static void writeTreesHeader(ostream &output)
+{
+	output.write((const char *) &treesMagic, sizeof(unsigned int));
+	output.write((const char *) &treesVersion, sizeof(unsigned int));
+}
+
+static bool readTreesHeader(istream &input)
+{
+	unsigned int magic = 0;
+	unsigned int version = 0;
+	input.read((char *) &magic, sizeof(unsigned int));
+	input.read((char *) &version, sizeof(unsigned int));
+	return input && magic == treesMagic && version == treesVersion;
+}
+
+/*! Writes a record per image: its label, its number of descriptors, their dimension and the descriptors one after the other, so 
+ *  that the images of a shard are read with one seek each. */
+template<typename T>
+static void writeImages(ostream &output, const CImg<T> &features, const vector<unsigned int> &labels, const vector<unsigned int> &nDescriptorsPerImage)
+{
+	unsigned int p = 0;
+	for (unsigned int i = 0; i < nDescriptorsPerImage.size(); ++i)
+	{
+		unsigned int n = nDescriptorsPerImage[i];
+		unsigned int header[3] = { n > 0 ? labels[p] : 0, n, (unsigned int)features.height() };
+		output.write((const char *) header, sizeof(header));
+		if (n > 0)
+		{
+			CImg<T> descriptors = features.get_columns(p, p + n - 1).transpose();
+			output.write((const char *) descriptors.data(), (size_t)n * features.height() * sizeof(T));
+		}
+		p += n;
+	}
+}
+
+/*! Reads the images of shard out of nShards, image i belonging to shard i % nShards, and seeks past the others. Returns false if a 
+ *  record is truncated or has a label out of range. */
+template<typename T>
+static bool readImages(istream &input, unsigned int shard, unsigned int nShards, unsigned int nLabels, CImg<T> &features, vector<unsigned int> &labels, vector<unsigned int> &nDescriptorsPerImage)
+{
+	CImgList<T> descriptorList;
+	labels.clear();
+	nDescriptorsPerImage.clear();
+	unsigned int header[3];
+	for (unsigned int i = 0; input.read((char *) header, sizeof(header)); ++i)
+	{
+		size_t size = (size_t)header[1] * header[2] * sizeof(T);
+		if (i % nShards != shard)
+		{
+			input.seekg(size, ios::cur);
+			continue;
+		}
+		if (header[0] >= nLabels) return false;
+		nDescriptorsPerImage.push_back(header[1]);
+		labels.insert(labels.end(), header[1], header[0]);
+		if (header[1] == 0) continue;
+		descriptorList.insert(CImg<T>(header[2], header[1]));
+		if (!input.read((char *) descriptorList.back().data(), size)) return false;
+	}
+	features = descriptorList.get_append('y');
+	descriptorList.clear();
+	features.transpose();
+	return true;
+}
+
+/*! Stores the training descriptors, as doubles in features or as bytes in byteFeatures, whichever is not empty. */
+void Checkpoint::saveDescriptors(unsigned int featureType, unsigned int nLabels, const CImg<double> &features, const CImg<unsigned char> &byteFeatures, const vector<unsigned int> &labels, const vector<unsigned int> &nDescriptorsPerImage) const
+{
+	beginDescriptors(featureType, nLabels, !byteFeatures.is_empty());
+	appendDescriptors(features, byteFeatures, labels, nDescriptorsPerImage);
+	endDescriptors();
+}
+
+/*! Starts a descriptor store that appendDescriptors fills a part at a time, and that replaces the previous one at endDescriptors. */
+void Checkpoint::beginDescriptors(unsigned int featureType, unsigned int nLabels, bool useBytes) const
+{
+	ofstream output(_getPath("descriptors.bin.tmp").c_str(), ios::trunc | ios::binary);
+	unsigned int bytes = useBytes ? 1 : 0;
+	output.write((const char *) &descriptorsVersion, sizeof(unsigned int));
+	output.write((const char *) &featureType, sizeof(unsigned int));
+	output.write((const char *) &nLabels, sizeof(unsigned int));
+	output.write((const char *) &bytes, sizeof(unsigned int));
+	output.flush();
+	if (!output.good())
+	{
+		output.close();
+		DeleteFile(_getPath("descriptors.bin.tmp").c_str());
+	}
+}
+
+/*! Adds the images of a part of the descriptors after those already stored, with the same type as the first. After a failed write the 
+ *  store is removed, so that the next parts are not written and endDescriptors commits nothing. */
+void Checkpoint::appendDescriptors(const CImg<double> &features, const CImg<unsigned char> &byteFeatures, const vector<unsigned int> &labels, const vector<unsigned int> &nDescriptorsPerImage) const
+{
+	traceScope("checkpoint");
+	fstream output(_getPath("descriptors.bin.tmp").c_str(), ios::in | ios::out | ios::binary);
+	if (!output.is_open()) return;
+	output.seekp(0, ios::end);
+	if (!byteFeatures.is_empty()) writeImages(output, byteFeatures, labels, nDescriptorsPerImage);
+	else writeImages(output, features, labels, nDescriptorsPerImage);
+	output.flush();
+	if (!output.good())
+	{
+		output.close();
+		DeleteFile(_getPath("descriptors.bin.tmp").c_str());
+	}
+}
+
+/*! Commits the descriptor store and returns whether every part of it was written. */
+bool Checkpoint::endDescriptors(void) const
+{
+	bool isCommitted = _replace("descriptors.bin");
+	if (!isCommitted) cout << "Cannot write \"" << _getPath("descriptors.bin") << "\", training must start over." << endl;
+	return isCommitted;
+}
+
+bool Checkpoint::loadDescriptors(unsigned int &featureType, unsigned int &nLabels, CImg<double> &features, CImg<unsigned char> &byteFeatures, vector<unsigned int> &labels, vector<unsigned int> &nDescriptorsPerImage) const
+{
+	return loadDescriptors(0, 1, featureType, nLabels, features, byteFeatures, labels, nDescriptorsPerImage);
+}
+
+/*! Reads the descriptors of shard out of nShards. Images are dealt to the shards in turn, so that every shard sees every class even 
+ *  though the store is ordered by class, and only the records of the shard are read from disk. */
+bool Checkpoint::loadDescriptors(unsigned int shard, unsigned int nShards, unsigned int &featureType, unsigned int &nLabels, CImg<double> &features, CImg<unsigned char> &byteFeatures, vector<unsigned int> &labels, vector<unsigned int> &nDescriptorsPerImage) const
+{
+	traceScope("checkpoint");
+	ifstream input(_getPath("descriptors.bin").c_str(), ios::in | ios::binary);
+	if (!input.is_open()) return false;
+	unsigned int version = 0;
+	unsigned int useBytes = 0;
+	input.read((char *) &version, sizeof(unsigned int));
+	if (version != descriptorsVersion) return false;
+	input.read((char *) &featureType, sizeof(unsigned int));
+	input.read((char *) &nLabels, sizeof(unsigned int));
+	input.read((char *) &useBytes, sizeof(unsigned int));
+	if (!input) return false;
+
+	features.assign();
+	byteFeatures.assign();
+	if (useBytes) return readImages(input, shard, nShards, nLabels, byteFeatures, labels, nDescriptorsPerImage);
+	return readImages(input, shard, nShards, nLabels, features, labels, nDescriptorsPerImage);
+}
+
+void Checkpoint::saveTree(const ErcForest &forest, unsigned int t) const
+{
+	traceScope("checkpoint");
+	string name = "tree" + to_string(t) + ".bin";
+	ofstream output(_getPath(name + ".tmp").c_str(), ios::trunc | ios::binary);
+	writeTreesHeader(output);
+	forest.writeTree(t, output);
+	_commit(name, output);
+}
+
+/*! Reads the trees trained so far into forest, in order, and returns how many. */
+unsigned int Checkpoint::loadTrees(ErcForest &forest) const
+{
+	unsigned int t = 0;
+	for (; t < forest.getNTrees(); ++t)
+	{
+		ifstream input(_getPath("tree" + to_string(t) + ".bin").c_str(), ios::in | ios::binary);
+		if (!input.is_open() || !readTreesHeader(input)) break;
+		forest.readTree(t, input);
+		if (!input) break;
+	}
+	return t;
+}
+
+void Checkpoint::saveForest(const ErcForest &forest) const
+{
+	_saveTrees(forest, "forest.bin");
+}
+
+/*! Reads the pruned forest, which must have as many trees as the one saved. */
+bool Checkpoint::loadForest(ErcForest &forest) const
+{
+	return _loadTrees(forest, 0, "forest.bin") == forest.getNTrees();
+}
+
+/*! Records the trees trained by the worker process of shard. */
+void Checkpoint::saveShard(const ErcForest &forest, unsigned int shard) const
+{
+	_saveTrees(forest, "shard" + to_string(shard) + ".bin");
+}
+
+/*! Reads the trees of shard into forest from tree firstTree on, and returns how many, 0 if the shard is missing. */
+unsigned int Checkpoint::loadShard(ErcForest &forest, unsigned int shard, unsigned int firstTree) const
+{
+	return _loadTrees(forest, firstTree, "shard" + to_string(shard) + ".bin");
+}
+
+void Checkpoint::_saveTrees(const ErcForest &forest, const string &name) const
+{
+	traceScope("checkpoint");
+	ofstream output(_getPath(name + ".tmp").c_str(), ios::trunc | ios::binary);
+	unsigned int nTrees = forest.getNTrees();
+	writeTreesHeader(output);
+	output.write((const char *) &nTrees, sizeof(unsigned int));
+	for (unsigned int t = 0; t < nTrees; ++t) forest.writeTree(t, output);
+	_commit(name, output);
+}
+
+unsigned int Checkpoint::_loadTrees(ErcForest &forest, unsigned int firstTree, const string &name) const
+{
+	ifstream input(_getPath(name).c_str(), ios::in | ios::binary);
+	if (!input.is_open() || !readTreesHeader(input)) return 0;
+	unsigned int nTrees = 0;
+	input.read((char *) &nTrees, sizeof(unsigned int));
+	if (!input || firstTree + nTrees > forest.getNTrees()) return 0;
+	for (unsigned int t = 0; t < nTrees; ++t) forest.readTree(firstTree + t, input);
+	return input ? nTrees : 0;
+}
+
+void Checkpoint::saveModels(const Classifier &classifier, unsigned int nTrainedModels) const
+{
+	traceScope("checkpoint");
+	ofstream output(_getPath("models.bin.tmp").c_str(), ios::trunc | ios::binary);
+	output.write((const char *) &nTrainedModels, sizeof(unsigned int));
+	classifier.write(output);
+	_commit("models.bin", output);
+}
+
+/*! Reads the models trained so far into classifier and returns how many, 0 if none were. */
+unsigned int Checkpoint::loadModels(Classifier &classifier) const
+{
+	ifstream input(_getPath("models.bin").c_str(), ios::in | ios::binary);
+	if (!input.is_open()) return 0;
+	unsigned int nTrainedModels = 0;
+	input.read((char *) &nTrainedModels, sizeof(unsigned int));
+	classifier.read(input);
+	return nTrainedModels;
+}
@@ -0,0 +1,44 @@
+/*! \file */
+
+#pragma once
+#include "stdafx.h"
+#include "ErcForest.h"
+#include "Classifier.h"
+
+namespace ercf
+{
+	/*! Binary files in a directory recording each finished stage of a training, so that an interrupted one resumes at its 
+	 *  first unfinished stage: the sampled descriptors, each trained tree, the pruned forest and the models after each label.
+	 *  Every file is written next to its final name and renamed once complete, so a crash never leaves a truncated stage.
+	 *  A sharded training also reads the descriptors of every n-th image for each worker and records the trees of each worker here. */
+	class Checkpoint
+	{
+	public:
+		Checkpoint(string directory);
+		void clear(void) const;
+		void saveDescriptors(unsigned int featureType, unsigned int nLabels, const CImg<double> &features, const CImg<unsigned char> &byteFeatures, const vector<unsigned int> &labels, const vector<unsigned int> &nDescriptorsPerImage) const;
+		void beginDescriptors(unsigned int featureType, unsigned int nLabels, bool useBytes) const;
+		void appendDescriptors(const CImg<double> &features, const CImg<unsigned char> &byteFeatures, const vector<unsigned int> &labels, const vector<unsigned int> &nDescriptorsPerImage) const;
+		bool endDescriptors(void) const;
+		bool loadDescriptors(unsigned int shard, unsigned int nShards, unsigned int &featureType, unsigned int &nLabels, CImg<double> &features, CImg<unsigned char> &byteFeatures, vector<unsigned int> &labels, vector<unsigned int> &nDescriptorsPerImage) const;
+		bool loadDescriptors(unsigned int &featureType, unsigned int &nLabels, CImg<double> &features, CImg<unsigned char> &byteFeatures, vector<unsigned int> &labels, vector<unsigned int> &nDescriptorsPerImage) const;
+		void saveTree(const ErcForest &forest, unsigned int t) const;
+		unsigned int loadTrees(ErcForest &forest) const;
+		void saveForest(const ErcForest &forest) const;
+		bool loadForest(ErcForest &forest) const;
+		void saveShard(const ErcForest &forest, unsigned int shard) const;
+		unsigned int loadShard(ErcForest &forest, unsigned int shard, unsigned int firstTree) const;
+		void saveModels(const Classifier &classifier, unsigned int nTrainedModels) const;
+		unsigned int loadModels(Classifier &classifier) const;
+
+	private:
+		string _getPath(const string &name) const;
+		void _deleteFiles(const string &pattern) const;
+		bool _commit(const string &name, ofstream &output) const;
+		bool _replace(const string &name) const;
+		void _saveTrees(const ErcForest &forest, const string &name) const;
+		unsigned int _loadTrees(ErcForest &forest, unsigned int firstTree, const string &name) const;
+
+		string _directory;
+	};
+}
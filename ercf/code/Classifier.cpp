@@ -1,10 +1,11 @@
 #include "StdAfx.h"
 #include "Classifier.h"
+#include "IncrementalScorer.h"
 
 using namespace ercf;
 
 Classifier::Classifier(const ErcForest *forest) 
-	: _forest(forest)
+	: _forest(forest), _compactForest(NULL), _compiledForest(NULL)
 {	
 	vl_rand_init(&_random);
 }
@@ -26,20 +27,90 @@ unsigned int Classifier::unmixedPoints(const CImg<double> &image, const CImg<dou
 	return n;
 }
 
-void Classifier::train(const TrainingSet &set, const vector<unsigned int> &nDescriptorsPerImage)
+unsigned int Classifier::unmixedPoints(const CImg<double> &features, unsigned int label) const
 {
-	unsigned int nImages = nDescriptorsPerImage.size();
-	_models.assign(_forest->getNLeaves() + 1, set.getNLabels());
-	CImg<vl_int8> binaryLabels(nImages, set.getNLabels());
+	unsigned int n = 0;
+	for (unsigned int i = 0; i < features.width(); ++i)
+	{
+		if (_forest->isUnmixed(features.get_column(i), label)) ++n;
+	}
+	return n;
+}
+
+/*! Trains the model of each label from firstLabel on, the previous ones being already trained, and calls onModelTrained after each of them. */
+void Classifier::train(const TrainingSet &set, const vector<unsigned int> &nDescriptorsPerImage, unsigned int firstLabel, const function<void(unsigned int)> &onModelTrained)
+{
+	CImg<double> histograms;
+	CImg<vl_int8> binaryLabels;
+	computeHistograms(set, nDescriptorsPerImage, histograms, binaryLabels);
+	train(histograms, binaryLabels, firstLabel, onModelTrained);
+}
+
+/*! Same from the histograms of computeHistograms, which can be computed on parts of the training set and appended. */
+void Classifier::train(const CImg<double> &histograms, const CImg<vl_int8> &binaryLabels, unsigned int firstLabel, const function<void(unsigned int)> &onModelTrained)
+{
+	unsigned int nLabels = binaryLabels.height();
+	if (firstLabel == 0 || _models.width() != _forest->getNLeaves() + 1 || _models.height() != nLabels)
+	{
+		_models.assign(_forest->getNLeaves() + 1, nLabels);
+		_models.fill(0.);
+		firstLabel = 0;
+	}
+
+	traceScope("svm");
+	for (unsigned int l = firstLabel; l < nLabels; ++l)
+	{
+		vl_pegasos_train_binary_svm_d(_models.data() + l * _models.width(), histograms.data(), _forest->getNLeaves(), histograms.height(), binaryLabels.data() + l * binaryLabels.width(), 1., 1., 1, nSvmIterations, &_random);
+		if (onModelTrained) onModelTrained(l);
+	}
+	_computeLeafWeights();
+
+}
+
+/*! Refines the models with new images after the forest was updated, see ErcForest::update: the weight of each new leaf starts 
+ *  from that of the leaf it grew from, and Pegasos resumes its step schedule from there on the new images only. 
+ *  Compact and compiled forests of the previous forest are dropped. */
+void Classifier::update(const TrainingSet &set, const vector<unsigned int> &nDescriptorsPerImage, const vector<unsigned int> &leafOrigins)
+{
+	unsigned int nLeaves = _forest->getNLeaves();
+	CImg<double> models(nLeaves + 1, _models.height());
+	for (unsigned int l = 0; l < models.height(); ++l)
+	{
+		for (unsigned int leaf = 0; leaf < nLeaves; ++leaf) models(leaf, l) = _models(leafOrigins[leaf], l);
+		models(nLeaves, l) = _models(_models.width() - 1, l);
+	}
+	_models.swap(models);
+	_compactForest = NULL;
+	_compiledForest = NULL;
+
+	CImg<double> histograms;
+	CImg<vl_int8> binaryLabels;
+	computeHistograms(set, nDescriptorsPerImage, histograms, binaryLabels);
+
+	traceScope("svm");
+	for (unsigned int l = 0; l < _models.height(); ++l)
+	{
+		vl_pegasos_train_binary_svm_d(_models.data() + l * _models.width(), histograms.data(), nLeaves, nDescriptorsPerImage.size(), binaryLabels.data() + l * binaryLabels.width(), 1., 1., nSvmIterations + 1, nSvmIterations, &_random);
+	}
+	_computeLeafWeights();
+}
 
-	CImg<double> histograms(_forest->getNLeaves(), nImages);
+/*! Normalized leaf histograms of the images of set, whose descriptors are consecutive, and their labels as +1 / -1 for each model. */
+void Classifier::computeHistograms(const TrainingSet &set, const vector<unsigned int> &nDescriptorsPerImage, CImg<double> &histograms, CImg<vl_int8> &binaryLabels) const
+{
+	traceScope("quantize");
+	unsigned int nImages = nDescriptorsPerImage.size();
+	binaryLabels.assign(nImages, set.getNLabels());
+	histograms.assign(_forest->getNLeaves(), nImages);
 	histograms.fill(0.);
 	unsigned int globalPoint = 0;
 	for (unsigned int i = 0; i < nImages; ++i)
 	{
 		for (unsigned int p = 0; p < nDescriptorsPerImage[i]; ++p)
 		{
-			_forest->classify(histograms.data() + i * _forest->getNLeaves(), set.getPointFeature(globalPoint));
+			double *histogram = histograms.data() + i * _forest->getNLeaves();
+			if (set.isIntegral()) _forest->classify(histogram, set.getPointByteFeature(globalPoint));
+			else _forest->classify(histogram, set.getPointFeature(globalPoint));
 			++globalPoint;
 		}
 		for (unsigned int l = 0; l < set.getNLabels(); ++l)
@@ -48,24 +119,144 @@ void Classifier::train(const TrainingSet &set, const vector<unsigned int> &nDesc
 		}
 	}
 	normalize(histograms);
+}
+
+double Classifier::classify(const CImg<double> &features, unsigned int label) const
+{
+	traceScope("quantize");
+	IncrementalScorer scorer(this);
+	scorer.add(features);
+	return scorer.getScores()[label];
+}
 
-	for (unsigned int l = 0; l < set.getNLabels(); ++l)
+/*! Scores a batch of images against every model at once: scores(l, i) is the decision function of label l for image i. */
+void Classifier::classify(const vector<const CImg<double> *> &featureList, CImg<double> &scores) const
+{
+	int nImages = featureList.size();
+	unsigned int nLeaves = _forest->getNLeaves();
+	CImg<double> histograms(nLeaves + 1, nImages);
+	histograms.fill(0.);
+	{
+		traceScope("quantize");
+#pragma omp parallel for
+		for (int i = 0; i < nImages; ++i)
+		{
+			_quantize(histograms.data() + i * histograms.width(), *featureList[i]);
+		}
+	}
+	normalize(histograms);
+	for (int i = 0; i < nImages; ++i)
 	{
-		vl_pegasos_train_binary_svm_d(_models.data() + l * _models.width(), histograms.data(), _forest->getNLeaves(), nImages, binaryLabels.data() + l * binaryLabels.width(), 1., 1., 1, 100, &_random);
+		histograms(nLeaves, i) = 1.;
 	}
 
+	traceScope("svm");
+	scores = histograms * _models.get_transpose();
 }
 
-double Classifier::classify(const CImg<double> &features, unsigned int label) const
+/*! Label of an image by summing the leaf distributions of its descriptors over all trees, without histogram nor SVM. 
+ *  margin is the lead of the winner over the runner-up, as a fraction of the total vote. */
+unsigned int Classifier::vote(const CImg<double> &features, double &margin) const
 {
-	CImg<double> histogram(_forest->getNLeaves() + 1);
+	traceScope("vote");
+	unsigned int nLabels = _forest->getNLabels();
+	vector<double> posterior(nLabels, 0.);
 	for (unsigned int f = 0; f < features.width(); ++f)
 	{
-		_forest->classify(histogram.data(), features.get_column(f));
+		_forest->vote(posterior.data(), features.get_column(f));
+	}
+
+	unsigned int best = 0;
+	double total = 0.;
+	for (unsigned int l = 0; l < nLabels; ++l)
+	{
+		total += posterior[l];
+		if (posterior[l] > posterior[best]) best = l;
 	}
-	normalize(histogram);
+	double second = 0.;
+	for (unsigned int l = 0; l < nLabels; ++l)
+	{
+		if (l != best) second = max(second, posterior[l]);
+	}
+	margin = (total > 0.) ? (posterior[best] - second) / total : 0.;
+	return best;
+}
 
-	return _models.get_line(label).dot(histogram);
+/*! Label of an image from the forest vote when it leads by at least minMargin, from the highest SVM decision function otherwise. */
+unsigned int Classifier::predict(const CImg<double> &features, double minMargin, bool *isVoted) const
+{
+	double margin;
+	unsigned int label = vote(features, margin);
+	if (isVoted != NULL) *isVoted = (margin >= minMargin);
+	if (margin >= minMargin) return label;
+
+	CImg<double> scores;
+	classify(vector<const CImg<double> *>(1, &features), scores);
+	label = 0;
+	for (unsigned int l = 1; l < getNModels(); ++l)
+	{
+		if (scores(l, 0) > scores(label, 0)) label = l;
+	}
+	return label;
+}
+
+/*! Classifies an image from batches of batchSize descriptors, stopping as soon as the best decision function leads the runner-up 
+ *  (or the decision boundary, with a single model) by minMargin, or once maxSeconds have passed. 
+ *  A leaf only counts once in the clipped histogram, so each decision function is updated the first time a leaf is reached. 
+ *  Having consumed every descriptor, the scores are those of classify. Returns the best label and its decision functions in scores. */
+unsigned int Classifier::classifyProgressive(DescriptorStream &stream, unsigned int batchSize, double minMargin, double maxSeconds, vector<double> &scores, bool *isConfident) const
+{
+	traceScope("progressive");
+	Timer timer;
+	timer.begin();
+	IncrementalScorer scorer(this);
+
+	unsigned int best = 0;
+	bool confident = false;
+	CImg<double> features;
+	while (!confident && timer.end() < maxSeconds && stream.next(batchSize, features) > 0)
+	{
+		scorer.add(features);
+		double margin;
+		best = scorer.getBest(margin);
+		confident = (margin >= minMargin);
+	}
+	Trace::counter("progressive descriptors", stream.getNExtracted());
+
+	scores = scorer.getScores();
+	if (isConfident != NULL) *isConfident = confident;
+	return best;
+}
+
+void Classifier::_quantize(double *histogram, const CImg<double> &features) const
+{
+	vector<unsigned int> leafIndices(_getNTrees());
+	for (unsigned int f = 0; f < features.width(); ++f)
+	{
+		_getLeafIndices(leafIndices.data(), features.get_column(f));
+		for (unsigned int t = 0; t < leafIndices.size(); ++t)
+		{
+			histogram[leafIndices[t]] += 1.;
+		}
+	}
+}
+
+/*! Histogram index of the leaf reached in each tree, through the compiled or the compact forest when one is set. */
+void Classifier::_getLeafIndices(unsigned int *leafIndices, const CImg<double> &feature) const
+{
+	if (_compiledForest != NULL) _compiledForest->getLeafIndices(leafIndices, feature);
+	else if (_compactForest != NULL) _compactForest->getLeafIndices(leafIndices, feature);
+	else _forest->getLeafIndices(leafIndices, feature);
+}
+
+unsigned int Classifier::_getNTrees(void) const
+{
+	return _forest->getNTrees();
+}
+
+void Classifier::_computeLeafWeights(void)
+{
+	_leafWeights = _models.get_transpose();
 }
 
 void Classifier::normalize(CImg<double> &histogram)
@@ -79,34 +270,86 @@ void Classifier::normalize(CImg<double> &histogram)
 void Classifier::save(string binFile) const
 {
 	ofstream bin;
-	unsigned int nModels = _models.height();
-	unsigned int nLeaves = _forest->getNLeaves();
 	bin.open(binFile.c_str(), ios::trunc | ios::binary);
-	bin.write((char *) &nModels, sizeof(unsigned int));
-	bin.write((char *) &nLeaves, sizeof(unsigned int));
-	bin.write((char *) _models.data(), _models.width() * _models.height() * sizeof(double));
+	write(bin);
 	bin.close();
 
-	cout << "Saved " << nModels << " models associated to a forest of " << nLeaves << " leaves." << endl;
+	cout << "Saved " << _models.height() << " models associated to a forest of " << _forest->getNLeaves() << " leaves." << endl;
 }
 
 void Classifier::load(string binFile)
 {
 	ifstream bin;
-	unsigned int nModels;
-	unsigned int nLeaves;
 	bin.open(binFile.c_str(), ios::in | ios::binary);
-	bin.read((char *) &nModels, sizeof(unsigned int));
-	bin.read((char *) &nLeaves, sizeof(unsigned int));
-	_models.assign(nLeaves + 1, nModels);
-	bin.read((char *) _models.data(), _models.width() * _models.height() * sizeof(double));
+	read(bin);
 	bin.close();
 
-	cout << "Loaded " << nModels << " models associated to a forest of " << nLeaves << " leaves." << endl;
+	cout << "Loaded " << _models.height() << " models associated to a forest of " << _models.width() - 1 << " leaves." << endl;
 
 }
 
+void Classifier::write(ostream &output) const
+{
+	unsigned int nModels = _models.height();
+	unsigned int nLeaves = _forest->getNLeaves();
+	output.write((char *) &nModels, sizeof(unsigned int));
+	output.write((char *) &nLeaves, sizeof(unsigned int));
+	output.write((char *) _models.data(), _models.width() * _models.height() * sizeof(double));
+}
+
+void Classifier::read(istream &input)
+{
+	unsigned int nModels;
+	unsigned int nLeaves;
+	input.read((char *) &nModels, sizeof(unsigned int));
+	input.read((char *) &nLeaves, sizeof(unsigned int));
+	if (!input) nModels = 0;
+	_models.assign(nLeaves + 1, nModels);
+	input.read((char *) _models.data(), _models.width() * _models.height() * sizeof(double));
+	if (!input) _models.assign();
+	_computeLeafWeights();
+}
+
+/*! Number of labels, 0 if the models could not be read. */
 unsigned int Classifier::getNModels(void) const
 {
 	return _models.height();
+}
+
+/*! Number of leaves of the forest the models were trained on, which must match the forest they are used with. */
+unsigned int Classifier::getNLeaves(void) const
+{
+	return _models.is_empty() ? 0 : _models.width() - 1;
+}
+
+/*! Contribution of each descriptor, stored as the columns of features, to the decision function of label when leaf counts are not clipped. */
+void Classifier::getDescriptorWeights(const CImg<double> &features, unsigned int label, vector<double> &weights) const
+{
+	vector<unsigned int> leafIndices(_getNTrees());
+	weights.assign(features.width(), 0.);
+	for (unsigned int f = 0; f < features.width(); ++f)
+	{
+		_getLeafIndices(leafIndices.data(), features.get_column(f));
+		for (unsigned int t = 0; t < leafIndices.size(); ++t)
+		{
+			weights[f] += _leafWeights(label, leafIndices[t]);
+		}
+	}
+}
+
+double Classifier::getBias(unsigned int label) const
+{
+	return _models(_models.width() - 1, label);
+}
+
+/*! Quantizes descriptors with the compact copy of the forest instead of the forest itself, NULL to go back to the forest. */
+void Classifier::setCompactForest(const CompactForest *compactForest)
+{
+	_compactForest = compactForest;
+}
+
+/*! Quantizes descriptors with the compiled copy of the forest, which takes precedence over a compact one, NULL to go back. */
+void Classifier::setCompiledForest(const CompiledForest *compiledForest)
+{
+	_compiledForest = compiledForest;
 }
\ No newline at end of file
@@ -1,26 +1,58 @@
 #pragma once
 #include "stdafx.h"
 #include "ErcForest.h"
+#include "CompactForest.h"
+#include "CompiledForest.h"
 #include "tools.h"
+#include "FeatureExtractor.h"
 
 namespace ercf
 {
 	class Classifier
 	{
+		friend class IncrementalScorer;
+
 	public:
+		/*! Pegasos iterations of a training, after which an update resumes the step schedule. */
+		static const unsigned int nSvmIterations = 100;
+
 		Classifier(const ErcForest *forest);
-		void train(const TrainingSet &set, const vector<unsigned int> &nDescriptorsPerImage);
+		void train(const TrainingSet &set, const vector<unsigned int> &nDescriptorsPerImage, unsigned int firstLabel = 0, const function<void(unsigned int)> &onModelTrained = nullptr);
+		void train(const CImg<double> &histograms, const CImg<vl_int8> &binaryLabels, unsigned int firstLabel = 0, const function<void(unsigned int)> &onModelTrained = nullptr);
+		void computeHistograms(const TrainingSet &set, const vector<unsigned int> &nDescriptorsPerImage, CImg<double> &histograms, CImg<vl_int8> &binaryLabels) const;
+		void update(const TrainingSet &set, const vector<unsigned int> &nDescriptorsPerImage, const vector<unsigned int> &leafOrigins);
 		unsigned int unmixedPoints(const CImg<double> &image, const CImg<double> &features, const CImg<double> &positions, unsigned int label) const;
+		unsigned int unmixedPoints(const CImg<double> &features, unsigned int label) const;
 		double classify(const CImg<double> &features, unsigned int label) const;
+		void classify(const vector<const CImg<double> *> &featureList, CImg<double> &scores) const;
+		unsigned int vote(const CImg<double> &features, double &margin) const;
+		unsigned int predict(const CImg<double> &features, double minMargin, bool *isVoted = NULL) const;
+		unsigned int classifyProgressive(DescriptorStream &stream, unsigned int batchSize, double minMargin, double maxSeconds, vector<double> &scores, bool *isConfident = NULL) const;
 		static void normalize(CImg<double> &histogram);
 		void save(string binFile) const;
 		void load(string binFile);
+		void write(ostream &output) const;
+		void read(istream &input);
 		unsigned int getNModels(void) const;
+		unsigned int getNLeaves(void) const;
+		void getDescriptorWeights(const CImg<double> &features, unsigned int label, vector<double> &weights) const;
+		double getBias(unsigned int label) const;
+		void setCompactForest(const CompactForest *compactForest);
+		void setCompiledForest(const CompiledForest *compiledForest);
 
 	private:
+		void _quantize(double *histogram, const CImg<double> &features) const;
+		void _getLeafIndices(unsigned int *leafIndices, const CImg<double> &feature) const;
+		unsigned int _getNTrees(void) const;
+		void _computeLeafWeights(void);
+
 		const ErcForest *_forest;
+		const CompactForest *_compactForest;
+		const CompiledForest *_compiledForest;
 		VlRand _random;
 		CImg<double> _models;
+		/*! Transpose of _models, so that the weights of a leaf for every label are contiguous, the biases being the last row. */
+		CImg<double> _leafWeights;
 	};
 }
 
@@ -0,0 +1,183 @@
+#include "stdafx.h"
+#include "CompactForest.h"
+
+using namespace ercf;
+
+/*! Nodes are laid out breadth first, tree after tree, with the two children of a node next to each other.
+ *  A leaf stores its index in the forest histogram in place of its first child. */
+CompactForest::CompactForest(const ErcForest &forest, unsigned int quantizationBits)
+	: _nLeaves(0), _maxLevel((unsigned short)((1 << quantizationBits) - 1))
+{
+	unsigned int featureDim = 0;
+	for (unsigned int t = 0; t < forest.getNTrees(); ++t)
+	{
+		vector<const ErcTree *> queue(1, &forest.getTree(t));
+		for (unsigned int n = 0; n < queue.size(); ++n)
+		{
+			if (queue[n]->isLeaf()) continue;
+			unsigned int featureIndex = queue[n]->getTestFeatureIndex();
+			double threshold = queue[n]->getTestThreshold();
+			if (featureIndex >= featureDim)
+			{
+				featureDim = featureIndex + 1;
+				_lowThresholds.resize(featureDim, numeric_limits<double>::max());
+				_scales.resize(featureDim, -numeric_limits<double>::max());
+			}
+			// _scales holds the highest threshold until the ranges are known
+			_lowThresholds[featureIndex] = min(_lowThresholds[featureIndex], threshold);
+			_scales[featureIndex] = max(_scales[featureIndex], threshold);
+			queue.push_back(queue[n]->getLeftChild());
+			queue.push_back(queue[n]->getRightChild());
+		}
+	}
+
+	// Level 0 is kept for values below every threshold, so that the lowest threshold stays exact
+	for (unsigned int f = 0; f < featureDim; ++f)
+	{
+		double range = _scales[f] - _lowThresholds[f];
+		_scales[f] = (range > 0.) ? (_maxLevel - 1) / range : 0.;
+	}
+
+	for (unsigned int t = 0; t < forest.getNTrees(); ++t)
+	{
+		_roots.push_back(_nodes.size());
+		vector<const ErcTree *> queue(1, &forest.getTree(t));
+		_nodes.resize(_nodes.size() + 1);
+		for (unsigned int n = 0; n < queue.size(); ++n)
+		{
+			Node &node = _nodes[_roots[t] + n];
+			if (queue[n]->isLeaf())
+			{
+				node.featureIndex = leafFeature;
+				node.threshold = 0;
+				node.child = _nLeaves + queue[n]->getLeafIndex();
+				continue;
+			}
+			node.featureIndex = (unsigned short)queue[n]->getTestFeatureIndex();
+			node.threshold = _quantizeThreshold(node.featureIndex, queue[n]->getTestThreshold());
+			node.child = _roots[t] + queue.size();
+			queue.push_back(queue[n]->getLeftChild());
+			queue.push_back(queue[n]->getRightChild());
+			_nodes.resize(_roots[t] + queue.size());
+		}
+		_nLeaves += forest.getTree(t).getNLeaves();
+	}
+}
+
+unsigned int CompactForest::getNLeaves(void) const
+{
+	return _nLeaves;
+}
+
+unsigned int CompactForest::getFeatureDim(void) const
+{
+	return _scales.size();
+}
+
+/*! Memory footprint of the nodes, in bytes. */
+size_t CompactForest::getSize(void) const
+{
+	return _nodes.size() * sizeof(Node);
+}
+
+unsigned short CompactForest::_quantizeThreshold(unsigned int featureIndex, double threshold) const
+{
+	double level = 1. + (threshold - _lowThresholds[featureIndex]) * _scales[featureIndex];
+	return (unsigned short)min(ceil(level), (double)_maxLevel);
+}
+
+/*! Descriptor values are rounded down and thresholds up, so x < threshold always holds in the quantized domain, 
+ *  and a test only flips when the value and the threshold fall in the same quantization step. */
+void CompactForest::quantize(unsigned short *quantized, const CImg<double> &feature) const
+{
+	for (unsigned int f = 0; f < _scales.size(); ++f)
+	{
+		quantized[f] = _quantizeValue(f, feature[f]);
+	}
+}
+
+inline unsigned short CompactForest::_quantizeValue(unsigned int featureIndex, double x) const
+{
+	if (x < _lowThresholds[featureIndex]) return 0;
+	return (unsigned short)min(floor(1. + (x - _lowThresholds[featureIndex]) * _scales[featureIndex]), (double)_maxLevel);
+}
+
+unsigned int CompactForest::_leaf(const unsigned short *quantized, unsigned int t) const
+{
+	const Node *nodes = _nodes.data();
+	unsigned int n = _roots[t];
+	while (nodes[n].featureIndex != leafFeature)
+	{
+		n = nodes[n].child + (quantized[nodes[n].featureIndex] >= nodes[n].threshold ? 1 : 0);
+	}
+	return nodes[n].child;
+}
+
+/*! Same traversal on a descriptor that is not quantized yet, quantizing only the values its nodes test instead of all of them. */
+unsigned int CompactForest::_leaf(const double *feature, unsigned int t) const
+{
+	const Node *nodes = _nodes.data();
+	unsigned int n = _roots[t];
+	while (nodes[n].featureIndex != leafFeature)
+	{
+		n = nodes[n].child + (_quantizeValue(nodes[n].featureIndex, feature[nodes[n].featureIndex]) >= nodes[n].threshold ? 1 : 0);
+	}
+	return nodes[n].child;
+}
+
+void CompactForest::classify(double *histogram, const unsigned short *quantized) const
+{
+	for (unsigned int t = 0; t < _roots.size(); ++t)
+	{
+		histogram[_leaf(quantized, t)] += 1.;
+	}
+}
+
+void CompactForest::classify(double *histogram, const CImg<double> &feature) const
+{
+	for (unsigned int t = 0; t < _roots.size(); ++t)
+	{
+		histogram[_leaf(feature.data(), t)] += 1.;
+	}
+}
+
+unsigned int CompactForest::getNTrees(void) const
+{
+	return _roots.size();
+}
+
+/*! Histogram index of the leaf reached by a quantized descriptor in each tree. */
+void CompactForest::getLeafIndices(unsigned int *leafIndices, const unsigned short *quantized) const
+{
+	for (unsigned int t = 0; t < _roots.size(); ++t)
+	{
+		leafIndices[t] = _leaf(quantized, t);
+	}
+}
+
+void CompactForest::getLeafIndices(unsigned int *leafIndices, const CImg<double> &feature) const
+{
+	for (unsigned int t = 0; t < _roots.size(); ++t)
+	{
+		leafIndices[t] = _leaf(feature.data(), t);
+	}
+}
+
+/*! Number of (descriptor, tree) leaf assignments that differ from the double-precision forest, over the columns of features. */
+unsigned int CompactForest::countMismatches(const ErcForest &forest, const CImg<double> &features) const
+{
+	vector<unsigned short> quantized(_scales.size());
+	unsigned int nMismatches = 0;
+	for (unsigned int i = 0; i < features.width(); ++i)
+	{
+		CImg<double> feature = features.get_column(i);
+		quantize(quantized.data(), feature);
+		unsigned int histOffset = 0;
+		for (unsigned int t = 0; t < _roots.size(); ++t)
+		{
+			if (_leaf(quantized.data(), t) != histOffset + forest.getTree(t).test(feature)->getLeafIndex()) ++nMismatches;
+			histOffset += forest.getTree(t).getNLeaves();
+		}
+	}
+	return nMismatches;
+}
@@ -0,0 +1,50 @@
+/*! \file */
+
+#pragma once
+#include "stdafx.h"
+#include "ErcForest.h"
+
+namespace ercf
+{
+	/*! Inference-only copy of an ErcForest where every node fits in 8 bytes.
+	 *  Thresholds are quantized to quantizationBits (16, or 8 for SIFT) over the range of the thresholds tested on each 
+	 *  feature dimension, rather than over the whole domain of the feature, which keeps more levels where the tests are. 
+	 *  Descriptor values are quantized the same way, either all at once or only those a traversal tests. Feature 
+	 *  dimensions must be below 0xFFFF. */
+	class CompactForest
+	{
+	public:
+		CompactForest(const ErcForest &forest, unsigned int quantizationBits = 16);
+		unsigned int getNLeaves(void) const;
+		unsigned int getFeatureDim(void) const;
+		size_t getSize(void) const;
+		void quantize(unsigned short *quantized, const CImg<double> &feature) const;
+		void classify(double *histogram, const unsigned short *quantized) const;
+		void classify(double *histogram, const CImg<double> &feature) const;
+		unsigned int getNTrees(void) const;
+		void getLeafIndices(unsigned int *leafIndices, const unsigned short *quantized) const;
+		void getLeafIndices(unsigned int *leafIndices, const CImg<double> &feature) const;
+		unsigned int countMismatches(const ErcForest &forest, const CImg<double> &features) const;
+
+	private:
+		struct Node
+		{
+			unsigned short featureIndex;
+			unsigned short threshold;
+			unsigned int child;
+		};
+		static const unsigned short leafFeature = 0xFFFF;
+
+		unsigned int _leaf(const unsigned short *quantized, unsigned int t) const;
+		unsigned int _leaf(const double *feature, unsigned int t) const;
+		unsigned short _quantizeThreshold(unsigned int featureIndex, double threshold) const;
+		unsigned short _quantizeValue(unsigned int featureIndex, double x) const;
+
+		vector<Node> _nodes;
+		vector<unsigned int> _roots;
+		unsigned int _nLeaves;
+		unsigned short _maxLevel;
+		vector<double> _lowThresholds;
+		vector<double> _scales;
+	};
+}
@@ -0,0 +1,77 @@
+#include "stdafx.h"
+#include "CompiledForest.h"
+
+using namespace ercf;
+
+CompiledForest::CompiledForest(string dllFile)
+	: _nTrees(0), _nLeaves(0), _classify(NULL), _getLeafIndices(NULL)
+{
+	_library = LoadLibrary(dllFile.c_str());
+	if (_library == NULL) return;
+
+	CountFunction nTrees = (CountFunction)GetProcAddress(_library, "ercfNTrees");
+	CountFunction nLeaves = (CountFunction)GetProcAddress(_library, "ercfNLeaves");
+	_classify = (ClassifyFunction)GetProcAddress(_library, "ercfClassify");
+	_getLeafIndices = (LeafIndicesFunction)GetProcAddress(_library, "ercfLeafIndices");
+	if (nTrees == NULL || nLeaves == NULL || _classify == NULL || _getLeafIndices == NULL)
+	{
+		FreeLibrary(_library);
+		_library = NULL;
+		_classify = NULL;
+		_getLeafIndices = NULL;
+		return;
+	}
+	_nTrees = nTrees();
+	_nLeaves = nLeaves();
+}
+
+CompiledForest::~CompiledForest(void)
+{
+	if (_library != NULL) FreeLibrary(_library);
+}
+
+bool CompiledForest::isLoaded(void) const
+{
+	return _classify != NULL;
+}
+
+unsigned int CompiledForest::getNTrees(void) const
+{
+	return _nTrees;
+}
+
+unsigned int CompiledForest::getNLeaves(void) const
+{
+	return _nLeaves;
+}
+
+void CompiledForest::classify(double *histogram, const CImg<double> &feature) const
+{
+	_classify(histogram, feature.data());
+}
+
+/*! Histogram index of the leaf reached by feature in each tree. */
+void CompiledForest::getLeafIndices(unsigned int *leafIndices, const CImg<double> &feature) const
+{
+	_getLeafIndices(leafIndices, feature.data());
+}
+
+/*! Number of descriptors, among the columns of features, whose histogram differs from the one of the interpreted forest. */
+unsigned int CompiledForest::countMismatches(const ErcForest &forest, const CImg<double> &features) const
+{
+	if (forest.getNLeaves() != _nLeaves || forest.getNTrees() != _nTrees) return features.width();
+
+	vector<double> compiledHistogram(_nLeaves, 0.);
+	vector<double> histogram(_nLeaves, 0.);
+	unsigned int nMismatches = 0;
+	for (unsigned int i = 0; i < features.width(); ++i)
+	{
+		CImg<double> feature = features.get_column(i);
+		fill(compiledHistogram.begin(), compiledHistogram.end(), 0.);
+		fill(histogram.begin(), histogram.end(), 0.);
+		classify(compiledHistogram.data(), feature);
+		forest.classify(histogram.data(), feature);
+		if (compiledHistogram != histogram) ++nMismatches;
+	}
+	return nMismatches;
+}
@@ -0,0 +1,36 @@
+/*! \file */
+
+#pragma once
+#include "stdafx.h"
+#include "ErcForest.h"
+
+namespace ercf
+{
+	/*! A forest compiled from the source generated by ErcForest::cpp and loaded from the resulting DLL. */
+	class CompiledForest
+	{
+	public:
+		CompiledForest(string dllFile);
+		~CompiledForest(void);
+		bool isLoaded(void) const;
+		unsigned int getNTrees(void) const;
+		unsigned int getNLeaves(void) const;
+		void classify(double *histogram, const CImg<double> &feature) const;
+		void getLeafIndices(unsigned int *leafIndices, const CImg<double> &feature) const;
+		unsigned int countMismatches(const ErcForest &forest, const CImg<double> &features) const;
+
+	private:
+		typedef unsigned int (*CountFunction)(void);
+		typedef void (*ClassifyFunction)(double *, const double *);
+		typedef void (*LeafIndicesFunction)(unsigned int *, const double *);
+
+		CompiledForest(const CompiledForest &forest);
+		CompiledForest &operator=(const CompiledForest &forest);
+
+		HMODULE _library;
+		unsigned int _nTrees;
+		unsigned int _nLeaves;
+		ClassifyFunction _classify;
+		LeafIndicesFunction _getLeafIndices;
+	};
+}
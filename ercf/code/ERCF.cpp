@@ -5,22 +5,61 @@
 #include "tools.h"
 #include "FeatureExtractor.h"
 #include "Classifier.h"
+#include "CompactForest.h"
+#include "CompiledForest.h"
+#include "ModelHandle.h"
+#include "Server.h"
+#include "Localizer.h"
+#include "Reservoir.h"
+#include "Checkpoint.h"
 
 using namespace ercf;
 
-void train(vector<string> imageSearchPaths, vector<string> maskSearchPaths, unsigned int featureType, unsigned int maxNPictures)
+/*! Reads the image search path of each class from a text file, each followed by the search path of its masks, empty for none. */
+void readSearchPaths(string pathFileName, vector<string> &imageSearchPaths, vector<string> &maskSearchPaths)
 {
+	FILE *pathFile = fopen(pathFileName.c_str(), "r");
+	if (pathFile == NULL) return;
+	char line[MAX_PATH];
+	while (fgets(line, MAX_PATH, pathFile))
+	{		
+		if (line[strlen(line) - 1] == '\n') line[strlen(line) - 1] = '\0';
+		imageSearchPaths.push_back(string(line));
+		if (!fgets(line, MAX_PATH, pathFile)) 
+		{
+			maskSearchPaths.push_back("");
+			break;
+		}			
+		if (line[strlen(line) - 1] == '\n') line[strlen(line) - 1] = '\0';
+		maskSearchPaths.push_back(string(line));
+	}
+	fclose(pathFile);
+}
+
+/*! Streams the descriptors of up to maxNPictures images per class through per-class reservoirs of maxNDescriptors in total, 
+ *  into features, or siftFeatures for SIFT, grouped by image. With onClassSampled, the sample of each class is handed to it as soon 
+ *  as it is final and then freed, so that the outputs stay empty and only one class is held at a time. */
+void sampleDescriptors(vector<string> imageSearchPaths, vector<string> maskSearchPaths, unsigned int featureType, unsigned int maxNPictures, unsigned int maxNDescriptors, 
+	CImg<double> &features, CImg<unsigned char> &siftFeatures, vector<unsigned int> &labels, vector<unsigned int> &nDescriptorsPerImage,
+	function<void(const CImg<double> &, const CImg<unsigned char> &, const vector<unsigned int> &, const vector<unsigned int> &)> onClassSampled = nullptr)
+{
+	traceScope("sample");
 	unsigned int nClasses = imageSearchPaths.size();
 	unsigned int maxNDescriptorsPerImage = 67;	
 	unsigned int patchSize = 16;
 	unsigned int imageBucketSize = 20;
-	CImgList<double> featureList(maxNDescriptorsPerImage * maxNPictures * nClasses);
-	vector<unsigned int> labels(featureList.size(), 0);
-	CImg<double> positions(featureList.size(), 2);
-	unsigned int nDescriptors = 0;
+	CImgList<double> featureList(maxNDescriptorsPerImage * imageBucketSize);
+	bool useSiftBytes = (featureType == 2);
+	CImgList<unsigned char> siftList(useSiftBytes ? featureList.size() : 0);
+	labels.assign(featureList.size(), 0);
+	Reservoir<double> reservoir(nClasses, useSiftBytes ? 0 : maxNDescriptors);
+	Reservoir<unsigned char> siftReservoir(nClasses, useSiftBytes ? maxNDescriptors : 0);
 	Timer totalTimer;
-	vector<unsigned int> nDescriptorsPerImage(maxNPictures * nClasses);
+	nDescriptorsPerImage.assign(imageBucketSize, 0);
 	unsigned int nImages = 0;
+	vector<unsigned int> nKept(nClasses, 0);
+	unsigned int nSampledImages = 0;
+	CImgList<float> imList;
 
 	totalTimer.begin();
 
@@ -44,9 +83,8 @@ void train(vector<string> imageSearchPaths, vector<string> maskSearchPaths, unsi
 		for (int i = 0; i < nPictures; i += imageBucketSize)
 		{
 
-			CImgList<double> imList;
-			CImgList<bool> maskList;
-			CImgList<bool> *maskListPtr;			
+			vector<BitMask> maskList;
+			vector<BitMask> *maskListPtr;			
 			Timer timer;
 
 			maskListPtr = useMasks ? &maskList : NULL;		
@@ -55,20 +93,21 @@ void train(vector<string> imageSearchPaths, vector<string> maskSearchPaths, unsi
 			unsigned int i1 = min(nPictures, i0 + imageBucketSize);
 
 			timer.begin();
-			loadImages<double>(imList, vector<string>(imagePaths.begin() + i0, imagePaths.begin() + i1));
+			loadHslImages(imList, vector<string>(imagePaths.begin() + i0, imagePaths.begin() + i1));
 			cout << "Pictures " << i0 << "->" << i1 << "/" << nPictures << " of class " << c << "/" << nClasses << " loaded in " << timer.end() << "s." << endl;
 
 			if (useMasks)
 			{
 				timer.begin();
-				loadImages<bool>(maskList, vector<string>(maskPaths.begin() + i0, maskPaths.begin() + i1));
+				loadMasks(maskList, vector<string>(maskPaths.begin() + i0, maskPaths.begin() + i1));
 				cout << "Masks " << i0 << "->" << i1 << "/" << nPictures << " of class " << c << "/" << nClasses << " loaded in " << timer.end() << "s." << endl;
 			}
 
 
 			timer.begin();
 
-			FeatureExtractor featureExtractor(&featureList, nDescriptorsPerImage.data() + nImages, &labels, maxNDescriptorsPerImage, &imList, maskListPtr);
+			FeatureExtractor featureExtractor(&featureList, nDescriptorsPerImage.data(), &labels, maxNDescriptorsPerImage, &imList, maskListPtr);
+			if (useSiftBytes) featureExtractor.setSiftList(&siftList);
 			
 			cout << "Feature extractor created in " << timer.end() << "s" << endl;
 
@@ -76,99 +115,660 @@ void train(vector<string> imageSearchPaths, vector<string> maskSearchPaths, unsi
 			timer.begin();
 
 			unsigned int nNewDecriptors;
-			if (featureType == 0) nNewDecriptors = featureExtractor.getMultipleHsl(nDescriptors, 0, imList.size(), patchSize, c);
-			else if (featureType == 1) nNewDecriptors = featureExtractor.getMultipleHslHaar(nDescriptors, 0, imList.size(), patchSize, c);
-			else nNewDecriptors = featureExtractor.getMultipleSift(nDescriptors, 0, imList.size(), c);
+			if (featureType == 0) nNewDecriptors = featureExtractor.getMultipleHsl(0, 0, imList.size(), patchSize, c);
+			else if (featureType == 1) nNewDecriptors = featureExtractor.getMultipleHslHaar(0, 0, imList.size(), patchSize, c);
+			else nNewDecriptors = featureExtractor.getMultipleSift(0, 0, imList.size(), c);
 
+			// The bucket streams through the reservoir, so memory only depends on the bucket size and the descriptor budget
+			unsigned int d = 0;
+			for (unsigned int k = 0; k < imList.size(); ++k)
+			{
+				for (unsigned int p = 0; p < nDescriptorsPerImage[k]; ++p, ++d)
+				{
+					if (useSiftBytes) siftReservoir.add(siftList[d], c, nImages + k);
+					else reservoir.add(featureList[d], c, nImages + k);
+				}
+			}
 
-			cout << "Descriptors " << nDescriptors << "->" << nDescriptors + nNewDecriptors << "/" << featureList.size() << " descriptors extracted in " << timer.end() << "s" << endl;
-			nDescriptors += nNewDecriptors;
+			cout << nNewDecriptors << " descriptors extracted in " << timer.end() << "s, " << (useSiftBytes ? siftReservoir.getNDescriptors(c) : reservoir.getNDescriptors(c)) << " of class " << c << " kept." << endl;
 
 			nImages += i1 - i0;
 		}		
+
+		nKept[c] = useSiftBytes ? siftReservoir.getNDescriptors(c) : reservoir.getNDescriptors(c);
+		if (onClassSampled)
+		{
+			CImg<double> classFeatures;
+			CImg<unsigned char> classSiftFeatures;
+			vector<unsigned int> classLabels;
+			vector<unsigned int> classNDescriptorsPerImage;
+			if (useSiftBytes) siftReservoir.get(c, classSiftFeatures, classLabels, classNDescriptorsPerImage);
+			else reservoir.get(c, classFeatures, classLabels, classNDescriptorsPerImage);
+			onClassSampled(classFeatures, classSiftFeatures, classLabels, classNDescriptorsPerImage);
+			nSampledImages += classNDescriptorsPerImage.size();
+			siftReservoir.release(c);
+			reservoir.release(c);
+		}
+	}
+
+	featureList.assign();
+	siftList.assign();
+	labels.clear();
+	nDescriptorsPerImage.clear();
+	if (!onClassSampled)
+	{
+		if (useSiftBytes) siftReservoir.get(siftFeatures, labels, nDescriptorsPerImage);
+		else reservoir.get(features, labels, nDescriptorsPerImage);
+		nSampledImages = nDescriptorsPerImage.size();
 	}
 
-	cout << "Spent " << totalTimer.end() << "s loading data and extracting " << nDescriptors << "/" << featureList.size() << "features." << endl;
+	cout << "Spent " << totalTimer.end() << "s loading data and sampling " << accumulate(nKept.begin(), nKept.end(), 0U) << "/" << maxNDescriptors << " descriptors from " << nSampledImages << " images." << endl;
+	for (unsigned int c = 0; c < nClasses; ++c)
+	{
+		cout << "Class " << c << ": kept " << nKept[c] << "/" << (useSiftBytes ? siftReservoir.getNSeen(c) : reservoir.getNSeen(c)) << " descriptors." << endl;
+	}
+}
 
-	while (featureList.size() > nDescriptors) featureList.pop_back();
-	CImg<double> features = featureList.get_append('x');
+/*! Number of descriptors sampled for training when none is given, for each worker in sharded training. */
+static const unsigned int defaultMaxNDescriptors = 100000;
 
+/*! Nodes of at least this fraction of the training set choose their split from feature histograms, which covers the top levels 
+ *  of the trees whatever the descriptor budget. */
+static const double approxSplitFraction = 1. / 8;
+
+unsigned int getApproxMinNPoints(const TrainingSet &set)
+{
+	return max((unsigned int)(approxSplitFraction * set.getNPoints()), 1U);
+}
+
+/*! Trains the forest and the classifier from the sampled descriptors, skipping the stages already recorded in checkpoint. */
+void trainModels(const Checkpoint &checkpoint, unsigned int nClasses, CImg<double> &features, CImg<unsigned char> &siftFeatures, vector<unsigned int> &labels, const vector<unsigned int> &nDescriptorsPerImage)
+{
+	Timer totalTimer;
 	totalTimer.begin();
-	TrainingSet set(&features, &labels, nClasses);
+	bool useSiftBytes = !siftFeatures.is_empty();
+	TrainingSet *setPtr = useSiftBytes ? new TrainingSet(&siftFeatures, &labels, nClasses) : new TrainingSet(&features, &labels, nClasses);
+	TrainingSet &set = *setPtr;
 	cout << "Training set created in " << totalTimer.end() << "s." << endl;
 	
 	totalTimer.begin();
 	ErcForest forest(5);
-	forest.train(set, 0.5, set.getFeatureDim());
-	forest.prune(1000);
+	if (checkpoint.loadForest(forest)) cout << "Resumed from the pruned forest." << endl;
+	else
+	{
+		unsigned int nTrainedTrees = checkpoint.loadTrees(forest);
+		if (nTrainedTrees > 0) cout << "Resumed from " << nTrainedTrees << "/" << forest.getNTrees() << " trained trees." << endl;
+		forest.setApproximateSplits(getApproxMinNPoints(set));
+		forest.train(set, 0.5, set.getFeatureDim(), nTrainedTrees, [&](unsigned int t)
+		{
+			checkpoint.saveTree(forest, t);
+		});
+		forest.prune(1000);
+		checkpoint.saveForest(forest);
+	}
 	forest.save("forest.xml");
 	cout << "Spent " << totalTimer.end() << "s training the forest and saving it to \"forest.xml\"." << endl;
 	
 	totalTimer.begin();
 	Classifier classifier(&forest);
-	classifier.train(set, nDescriptorsPerImage);
+	unsigned int nTrainedModels = checkpoint.loadModels(classifier);
+	if (nTrainedModels > 0) cout << "Resumed from " << nTrainedModels << "/" << nClasses << " trained models." << endl;
+	classifier.train(set, nDescriptorsPerImage, nTrainedModels, [&](unsigned int l)
+	{
+		checkpoint.saveModels(classifier, l + 1);
+	});
 	classifier.save("classifier.bin");
 	cout << "Spent " << totalTimer.end() << "s training the SVM classifier and saving it to \"classifier.bin\"." << endl;
 
+	delete setPtr;
+}
+
+/*! Trains the models on up to maxNPictures images per class and maxNDescriptors descriptors in total, saving each stage in "checkpoint". */
+void train(vector<string> imageSearchPaths, vector<string> maskSearchPaths, unsigned int featureType, unsigned int maxNPictures, unsigned int maxNDescriptors)
+{
+	traceScope("train");
+	unsigned int nClasses = imageSearchPaths.size();
+	CImg<double> features;
+	CImg<unsigned char> siftFeatures;
+	vector<unsigned int> labels;
+	vector<unsigned int> nDescriptorsPerImage;
+	Checkpoint checkpoint("checkpoint");
+	checkpoint.clear();
+	sampleDescriptors(imageSearchPaths, maskSearchPaths, featureType, maxNPictures, maxNDescriptors, features, siftFeatures, labels, nDescriptorsPerImage);
+	checkpoint.saveDescriptors(featureType, nClasses, features, siftFeatures, labels, nDescriptorsPerImage);
+	trainModels(checkpoint, nClasses, features, siftFeatures, labels, nDescriptorsPerImage);
+}
+
+/*! Resumes an interrupted training at the first stage missing from checkpointDirectory. */
+void resume(string checkpointDirectory)
+{
+	traceScope("train");
+	unsigned int featureType;
+	unsigned int nClasses;
+	CImg<double> features;
+	CImg<unsigned char> siftFeatures;
+	vector<unsigned int> labels;
+	vector<unsigned int> nDescriptorsPerImage;
+	Checkpoint checkpoint(checkpointDirectory);
+	if (!checkpoint.loadDescriptors(featureType, nClasses, features, siftFeatures, labels, nDescriptorsPerImage))
+	{
+		cout << "No descriptors to resume from in \"" << checkpointDirectory << "\", training must start over." << endl;
+		return;
+	}
+	cout << "Resumed from " << labels.size() << " descriptors of type " << featureType << " from " << nDescriptorsPerImage.size() << " images of " << nClasses << " classes." << endl;
+	trainModels(checkpoint, nClasses, features, siftFeatures, labels, nDescriptorsPerImage);
 }
 
+/*! Trains nTrees trees on the images of shard out of nShards in the descriptor store of checkpointDirectory, each on a bootstrap sample 
+ *  of the shard with useBagging, and records them for trainSharded. Returns the exit code of the worker process. */
+int trainShard(string checkpointDirectory, unsigned int shard, unsigned int nShards, unsigned int nTrees, bool useBagging)
+{
+	traceScope("trainShard");
+	unsigned int featureType;
+	unsigned int nClasses;
+	CImg<double> features;
+	CImg<unsigned char> siftFeatures;
+	vector<unsigned int> labels;
+	vector<unsigned int> nDescriptorsPerImage;
+	Checkpoint checkpoint(checkpointDirectory);
+	if (!checkpoint.loadDescriptors(shard, nShards, featureType, nClasses, features, siftFeatures, labels, nDescriptorsPerImage) || labels.empty()) return 1;
+
+	TrainingSet *setPtr = !siftFeatures.is_empty() ? new TrainingSet(&siftFeatures, &labels, nClasses) : new TrainingSet(&features, &labels, nClasses);
+	TrainingSet &set = *setPtr;
+	ErcForest forest(nTrees);
+	forest.setSeed(999 + shard * nTrees);
+	if (useBagging) forest.setBagging(1.);
+	forest.setApproximateSplits(getApproxMinNPoints(set));
+	forest.train(set, 0.5, set.getFeatureDim());
+	forest.prune(1000);
+	checkpoint.saveShard(forest, shard);
+	cout << "Shard " << shard << "/" << nShards << ": trained " << nTrees << " trees on " << labels.size() << " descriptors." << endl;
+
+	delete setPtr;
+	return 0;
+}
+
+/*! Trains a forest of nShards x nTreesPerShard trees in nShards worker processes, at most maxNProcesses at a time, each loading only its 
+ *  share of the images of the descriptor store, which samples maxNDescriptorsPerShard descriptors per worker, and merges their trees in shard order, which fixes the histogram bins of the leaves. 
+ *  The store is written one class at a time and the SVM is trained on histograms computed one shard at a time, so no process holds 
+ *  all the descriptors. Workers only communicate through the files of the checkpoint directory. */
+void trainSharded(vector<string> imageSearchPaths, vector<string> maskSearchPaths, unsigned int featureType, unsigned int maxNPictures, unsigned int nShards, unsigned int nTreesPerShard, bool useBagging, unsigned int maxNProcesses, unsigned int maxNDescriptorsPerShard)
+{
+	traceScope("trainSharded");
+	unsigned int nClasses = imageSearchPaths.size();
+	string checkpointDirectory = "checkpoint";
+	Checkpoint checkpoint(checkpointDirectory);
+	checkpoint.clear();
+	{
+		CImg<double> features;
+		CImg<unsigned char> siftFeatures;
+		vector<unsigned int> labels;
+		vector<unsigned int> nDescriptorsPerImage;
+		checkpoint.beginDescriptors(featureType, nClasses, featureType == 2);
+		sampleDescriptors(imageSearchPaths, maskSearchPaths, featureType, maxNPictures, maxNDescriptorsPerShard * nShards, features, siftFeatures, labels, nDescriptorsPerImage, 
+			[&](const CImg<double> &classFeatures, const CImg<unsigned char> &classSiftFeatures, const vector<unsigned int> &classLabels, const vector<unsigned int> &classNDescriptorsPerImage)
+		{
+			checkpoint.appendDescriptors(classFeatures, classSiftFeatures, classLabels, classNDescriptorsPerImage);
+		});
+		if (!checkpoint.endDescriptors()) return;
+	}
+
+	Timer timer;
+	timer.begin();
+	vector<string> commandLines;
+	for (unsigned int w = 0; w < nShards; ++w)
+	{
+		stringstream commandLine;
+		commandLine << "\"" << getExecutablePath() << "\" --shard-worker \"" << checkpointDirectory << "\" " << w << " " << nShards << " " << nTreesPerShard << " " << (useBagging ? 1 : 0);
+		commandLines.push_back(commandLine.str());
+	}
+	if (!runProcesses(commandLines, maxNProcesses))
+	{
+		cout << "A worker failed, its shard must be trained again." << endl;
+		return;
+	}
+
+	ErcForest forest(nShards * nTreesPerShard);
+	for (unsigned int w = 0; w < nShards; ++w)
+	{
+		if (checkpoint.loadShard(forest, w, w * nTreesPerShard) != nTreesPerShard)
+		{
+			cout << "The trees of shard " << w << " are missing." << endl;
+			return;
+		}
+	}
+	checkpoint.saveForest(forest);
+	forest.save("forest.xml");
+	cout << "Spent " << timer.end() << "s training " << forest.getNTrees() << " trees in " << nShards << " processes and saving the forest to \"forest.xml\"." << endl;
+
+	timer.begin();
+	Classifier classifier(&forest);
+	CImg<double> histograms;
+	CImg<vl_int8> binaryLabels;
+	for (unsigned int w = 0; w < nShards; ++w)
+	{
+		unsigned int shardFeatureType;
+		CImg<double> features;
+		CImg<unsigned char> siftFeatures;
+		vector<unsigned int> labels;
+		vector<unsigned int> nDescriptorsPerImage;
+		checkpoint.loadDescriptors(w, nShards, shardFeatureType, nClasses, features, siftFeatures, labels, nDescriptorsPerImage);
+		if (labels.empty()) continue;
+		TrainingSet *setPtr = !siftFeatures.is_empty() ? new TrainingSet(&siftFeatures, &labels, nClasses) : new TrainingSet(&features, &labels, nClasses);
+		CImg<double> shardHistograms;
+		CImg<vl_int8> shardBinaryLabels;
+		classifier.computeHistograms(*setPtr, nDescriptorsPerImage, shardHistograms, shardBinaryLabels);
+		histograms.append(shardHistograms, 'y');
+		binaryLabels.append(shardBinaryLabels, 'x');
+		delete setPtr;
+	}
+	classifier.train(histograms, binaryLabels, 0, [&](unsigned int l)
+	{
+		checkpoint.saveModels(classifier, l + 1);
+	});
+	classifier.save("classifier.bin");
+	cout << "Spent " << timer.end() << "s training the SVM classifier and saving it to \"classifier.bin\"." << endl;
+}
+
+/*! Refines the forest at forestPath and the classifier at classifierPath with up to maxNDescriptors descriptors of new images instead of 
+ *  retraining them, and saves both in place. */
+void update(string forestPath, string classifierPath, vector<string> imageSearchPaths, vector<string> maskSearchPaths, unsigned int featureType, unsigned int maxNPictures, unsigned int maxNDescriptors)
+{
+	traceScope("update");
+	ErcForest forest(forestPath);
+	Classifier classifier(&forest);
+	classifier.load(classifierPath);
+	if (imageSearchPaths.size() != classifier.getNModels())
+	{
+		cout << "The classifier has " << classifier.getNModels() << " labels but " << imageSearchPaths.size() << " classes are given." << endl;
+		return;
+	}
+
+	unsigned int nClasses = imageSearchPaths.size();
+	bool useSiftBytes = (featureType == 2);
+	CImg<double> features;
+	CImg<unsigned char> siftFeatures;
+	vector<unsigned int> labels;
+	vector<unsigned int> nDescriptorsPerImage;
+	sampleDescriptors(imageSearchPaths, maskSearchPaths, featureType, maxNPictures, maxNDescriptors, features, siftFeatures, labels, nDescriptorsPerImage);
+	TrainingSet *setPtr = useSiftBytes ? new TrainingSet(&siftFeatures, &labels, nClasses) : new TrainingSet(&features, &labels, nClasses);
+	TrainingSet &set = *setPtr;
+
+	Timer timer;
+	timer.begin();
+	unsigned int nLeaves = forest.getNLeaves();
+	vector<unsigned int> leafOrigins;
+	forest.update(set, 1000, 0.5, set.getFeatureDim(), 1000, leafOrigins);
+	forest.save(forestPath);
+	cout << "Spent " << timer.end() << "s updating the forest from " << nLeaves << " to " << forest.getNLeaves() << " leaves and saving it to \"" << forestPath << "\"." << endl;
+
+	timer.begin();
+	classifier.update(set, nDescriptorsPerImage, leafOrigins);
+	classifier.save(classifierPath);
+	cout << "Spent " << timer.end() << "s updating the SVM classifier and saving it to \"" << classifierPath << "\"." << endl;
+
+	delete setPtr;
+}
 
 void test(string forestPath, string classifierPath, string testImagePath, unsigned int featureType)
 {
+	traceScope("test");
 	ErcForest forest(forestPath);
 	Classifier classifier(&forest);
 	classifier.load(classifierPath);
 
 	unsigned int maxNDescriptors = 8000;
 
-	unsigned int nDescriptorsPerImage;
-	CImgList<double> imList;
-	CImgList<double> featureList(maxNDescriptors);
-	CImg<double> positions(featureList.size(), 2);
+	CImgList<float> imList;
+	CImg<double> features;
+	CImg<double> positions;
 
 	vector<string> imagePaths;
 	imagePaths.push_back(testImagePath);
-	loadImages<double>(imList, imagePaths);
-	FeatureExtractor featureExtractor(&featureList, &nDescriptorsPerImage, &positions, maxNDescriptors, &imList);
+	loadHslImages(imList, imagePaths);
+	FeatureExtractor::describe(imList, 0, featureType, maxNDescriptors, 16, features, positions);
 
-	unsigned int nDescriptors;
-	if (featureType == 0) nDescriptors = featureExtractor.getHsl(0, 0, 16);
-	else if (featureType == 1) nDescriptors = featureExtractor.getHslHaar(0, 0, 16);
-	else nDescriptors = featureExtractor.getSift(0, 0);
+	for (unsigned int c = 0; c < classifier.getNModels(); ++c)
+	{
+		cout << classifier.unmixedPoints(imList.at(0), features, positions, c) << " unmixed points for label " << c <<  endl;
+		cout << "Decision function for label " << c << ": " << classifier.classify(features, c) << endl;
+	}
+
+	Localizer localizer(&classifier);
+	for (unsigned int c = 0; c < classifier.getNModels(); ++c)
+	{
+		unsigned int box[4];
+		double score = localizer.localize(features, positions, imList.at(0).width(), imList.at(0).height(), c, box);
+		cout << "Best box for label " << c << ": (" << box[0] << ", " << box[1] << ") to (" << box[2] << ", " << box[3] << "), decision function " << score << endl;
+	}
 
-	while (featureList.size() > nDescriptors) featureList.pop_back();
-	CImg<double> features = featureList.get_append('x');
+	double margin;
+	unsigned int votedLabel = classifier.vote(features, margin);
+	bool isVoted;
+	unsigned int label = classifier.predict(features, 0.1, &isVoted);
+	cout << "Forest vote: label " << votedLabel << " with a margin of " << margin << "." << endl;
+	cout << "Predicted label " << label << (isVoted ? " from the forest vote." : " from the SVM.") << endl;
+
+	DescriptorStream stream(imList, 0, featureType, maxNDescriptors, 16);
+	vector<double> scores;
+	bool isConfident;
+	unsigned int progressiveLabel = classifier.classifyProgressive(stream, 200, 1., 0.5, scores, &isConfident);
+	cout << "Progressive classification: label " << progressiveLabel << " after " << stream.getNExtracted() << " descriptors" << (isConfident ? "." : ", without reaching the margin.") << endl;
+}
 
+void testTiled(string forestPath, string classifierPath, unsigned int featureType, string testImagePath, unsigned int tileSize)
+{
+	traceScope("testTiled");
+	ErcForest forest(forestPath);
+	Classifier classifier(&forest);
+	classifier.load(classifierPath);
+
+	CImg<double> features;
+	CImg<double> positions;
+	unsigned int width, height;
+	TiledExtractor extractor(featureType, 16, tileSize);
+	unsigned int nDescriptors = extractor.describe(testImagePath, 8000, features, positions, width, height);
+	cout << nDescriptors << " descriptors extracted from " << width << "x" << height << " image \"" << testImagePath << "\" in tiles of " << tileSize << " pixels." << endl;
+
+	Localizer localizer(&classifier);
 	for (unsigned int c = 0; c < classifier.getNModels(); ++c)
 	{
-		cout << classifier.unmixedPoints(imList.at(0), features, positions, c) << " unmixed points for label " << c <<  endl;
+		unsigned int box[4];
 		cout << "Decision function for label " << c << ": " << classifier.classify(features, c) << endl;
+		double score = localizer.localize(features, positions, width, height, c, box);
+		cout << "Best box for label " << c << ": (" << box[0] << ", " << box[1] << ") to (" << box[2] << ", " << box[3] << "), decision function " << score << endl;
+	}
+}
+
+/*! The server that Ctrl+C and the other console events stop, since the socket protocol has no shutdown request. */
+static InferenceServer *servedServer = NULL;
+
+static BOOL WINAPI stopServing(DWORD controlType)
+{
+	if (servedServer == NULL) return FALSE;
+	servedServer->stop();
+	return TRUE;
+}
+
+void serve(string forestPath, string classifierPath, unsigned int featureType, string socketPath, unsigned int nWorkers, unsigned int maxBatchSize, unsigned int maxDelay)
+{
+	ModelHandle models;
+	if (models.load(forestPath, classifierPath) == 0)
+	{
+		cout << "Cannot load \"" << forestPath << "\" and \"" << classifierPath << "\"." << endl;
+		return;
+	}
+
+	InferenceServer server(&models, featureType, nWorkers, maxBatchSize, maxDelay);
+	if (!server.listen(socketPath))
+	{
+		cout << "Cannot listen on \"" << socketPath << "\"." << endl;
+		return;
 	}
+	cout << "Serving forest \"" << forestPath << "\" and classifier \"" << classifierPath << "\" on \"" << socketPath << "\" with " << nWorkers << " workers, Ctrl+C to stop." << endl;
+	servedServer = &server;
+	SetConsoleCtrlHandler(stopServing, TRUE);
+	server.run();
+	SetConsoleCtrlHandler(stopServing, FALSE);
+	servedServer = NULL;
+}
+
+/*! Scores every image matched by imageQuery, a glob or a ".txt" list with one path per line, and streams one row per image 
+ *  to outputPath, as JSON lines if it ends with ".jsonl" and as CSV otherwise. Rows come in completion order. */
+void batchTest(string forestPath, string classifierPath, unsigned int featureType, string imageQuery, string outputPath, unsigned int nThreads)
+{
+	ErcForest forest(forestPath);
+	Classifier classifier(&forest);
+	classifier.load(classifierPath);
+	unsigned int nLabels = classifier.getNModels();
+	unsigned int maxNDescriptors = 8000;
+
+	vector<string> imagePaths;
+	if (imageQuery.size() > 4 && imageQuery.substr(imageQuery.size() - 4) == ".txt")
+	{
+		ifstream list(imageQuery.c_str());
+		string line;
+		while (getline(list, line))
+		{
+			if (line.size() > 0 && line[line.size() - 1] == '\r') line.erase(line.size() - 1);
+			if (line.size() > 0) imagePaths.push_back(line);
+		}
+	}
+	else imagePaths = getFileNames(imageQuery);
+
+	bool isJson = outputPath.size() > 6 && outputPath.substr(outputPath.size() - 6) == ".jsonl";
+	ofstream output(outputPath.c_str(), ios::trunc);
+	if (!isJson)
+	{
+		output << "image,descriptors";
+		for (unsigned int l = 0; l < nLabels; ++l) output << ",score_" << l;
+		for (unsigned int l = 0; l < nLabels; ++l) output << ",unmixed_" << l;
+		output << endl;
+	}
+
+	cout << "Scoring " << imagePaths.size() << " images to \"" << outputPath << "\" with " << nThreads << " threads." << endl;
+	Timer timer;
+	timer.begin();
+	int nImages = imagePaths.size();
+	unsigned int nDone = 0;
+#pragma omp parallel for schedule(dynamic) num_threads(nThreads)
+	for (int i = 0; i < nImages; ++i)
+	{
+		CImgList<float> imList;
+		CImg<double> features;
+		CImg<double> positions;
+		CImg<double> scores;
+		vector<unsigned int> unmixed(nLabels, 0);
+		unsigned int nDescriptors = 0;
+		bool isScored = false;
+		string error;
+		try
+		{
+			loadHslImages(imList, vector<string>(1, imagePaths[i]));
+			nDescriptors = FeatureExtractor::describe(imList, 0, featureType, maxNDescriptors, 16, features, positions);
+			if (nDescriptors > 0)
+			{
+				classifier.classify(vector<const CImg<double> *>(1, &features), scores);
+				for (unsigned int l = 0; l < nLabels; ++l) unmixed[l] = classifier.unmixedPoints(features, l);
+				isScored = true;
+			}
+			else error = "no descriptor extracted";
+		}
+		catch (CImgException &e)
+		{
+			error = e.what();
+		}
+		catch (exception &e)
+		{
+			// Any other failure is reported in the row of its image instead of ending the whole batch
+			error = e.what();
+		}
+
+		stringstream row;
+		if (isJson)
+		{
+			row << "{\"image\":\"" << escapeJson(imagePaths[i]) << "\",\"descriptors\":" << nDescriptors;
+			if (isScored)
+			{
+				row << ",\"scores\":[";
+				for (unsigned int l = 0; l < nLabels; ++l) row << (l > 0 ? "," : "") << scores(l, 0);
+				row << "],\"unmixed\":[";
+				for (unsigned int l = 0; l < nLabels; ++l) row << (l > 0 ? "," : "") << unmixed[l];
+				row << "]";
+			}
+			else row << ",\"error\":\"" << escapeJson(error) << "\"";
+			row << "}";
+		}
+		else
+		{
+			string quoted;
+			for (unsigned int c = 0; c < imagePaths[i].size(); ++c)
+			{
+				if (imagePaths[i][c] == '"') quoted += '"';
+				quoted += imagePaths[i][c];
+			}
+			row << "\"" << quoted << "\"," << nDescriptors;
+			for (unsigned int l = 0; l < nLabels; ++l)
+			{
+				row << ",";
+				if (isScored) row << scores(l, 0);
+			}
+			for (unsigned int l = 0; l < nLabels; ++l)
+			{
+				row << ",";
+				if (isScored) row << unmixed[l];
+			}
+		}
+
+#pragma omp critical(batchOutput)
+		{
+			output << row.str() << "\n";
+			if (++nDone % 1000 == 0)
+			{
+				output.flush();
+				cout << nDone << "/" << nImages << " images scored in " << timer.end() << "s." << endl;
+			}
+		}
+	}
+	output.close();
+	cout << "Spent " << timer.end() << "s scoring " << nImages << " images." << endl;
+}
+
+/*! Compiles forestPath into a CompactForest and reports its size and how many leaf assignments change on the descriptors of the images matched by imageQuery. */
+void compact(string forestPath, unsigned int featureType, string imageQuery, unsigned int quantizationBits)
+{
+	ErcForest forest(forestPath);
+	CompactForest compactForest(forest, quantizationBits);
+	cout << "Compiled " << forest.getNTrees() << " trees and " << compactForest.getNLeaves() << " leaves into " << compactForest.getSize() << " bytes with " << quantizationBits << "-bit thresholds." << endl;
+
+	vector<string> imagePaths = getFileNames(imageQuery);
+	unsigned int nDescriptors = 0;
+	unsigned int nMismatches = 0;
+	for (unsigned int i = 0; i < imagePaths.size(); ++i)
+	{
+		CImgList<float> imList;
+		CImg<double> features;
+		CImg<double> positions;
+		loadHslImages(imList, vector<string>(1, imagePaths[i]));
+		nDescriptors += FeatureExtractor::describe(imList, 0, featureType, 8000, 16, features, positions);
+		nMismatches += compactForest.countMismatches(forest, features);
+	}
+	cout << nMismatches << "/" << nDescriptors * forest.getNTrees() << " leaf assignments changed over " << nDescriptors << " descriptors of " << imagePaths.size() << " images." << endl;
+}
+
+/*! Checks that the forest compiled into dllFile gives the same histograms as forestPath on the descriptors of the images matched by imageQuery. */
+bool verifyCompiled(string forestPath, string dllFile, unsigned int featureType, string imageQuery)
+{
+	ErcForest forest(forestPath);
+	CompiledForest compiledForest(dllFile);
+	if (!compiledForest.isLoaded())
+	{
+		cout << "Cannot load a compiled forest from \"" << dllFile << "\"." << endl;
+		return false;
+	}
+
+	vector<string> imagePaths = getFileNames(imageQuery);
+	unsigned int nDescriptors = 0;
+	unsigned int nMismatches = 0;
+	for (unsigned int i = 0; i < imagePaths.size(); ++i)
+	{
+		CImgList<float> imList;
+		CImg<double> features;
+		CImg<double> positions;
+		loadHslImages(imList, vector<string>(1, imagePaths[i]));
+		nDescriptors += FeatureExtractor::describe(imList, 0, featureType, 8000, 16, features, positions);
+		nMismatches += compiledForest.countMismatches(forest, features);
+	}
+	cout << nMismatches << "/" << nDescriptors << " descriptors of " << imagePaths.size() << " images quantized differently by \"" << dllFile << "\" and \"" << forestPath << "\"." << endl;
+	return nMismatches == 0;
+}
+
+/*! Writes "trace.json" and prints the time spent in each span, when tracing was enabled. */
+void exportTrace(void)
+{
+	if (!Trace::isEnabled()) return;
+	Trace::exportChromeJson("trace.json");
+	Trace::printSummary(cout);
 }
 
 int main(unsigned int argc, char* argv[])
 {	
-	if (argc == 2)
+	// Tracing records every span, so it only runs when asked for
+	Trace::enable(getenv("ERCF_TRACE") != NULL);
+
+	if (argc >= 6 && string(argv[1]) == "--serve")
+	{
+		Trace::enable(false);
+		unsigned int nWorkers = argc >= 7 ? atoi(argv[6]) : thread::hardware_concurrency();
+		unsigned int maxBatchSize = argc >= 8 ? atoi(argv[7]) : 16;
+		unsigned int maxDelay = argc >= 9 ? atoi(argv[8]) : 2000;
+		serve(argv[2], argv[3], atoi(argv[4]), argv[5], nWorkers, maxBatchSize, maxDelay);
+	}
+	else if (argc >= 7 && string(argv[1]) == "--batch")
+	{
+		Trace::enable(false);
+		unsigned int nThreads = argc >= 8 ? atoi(argv[7]) : thread::hardware_concurrency();
+		batchTest(argv[2], argv[3], atoi(argv[4]), argv[5], argv[6], nThreads);
+	}
+	else if (argc >= 5 && string(argv[1]) == "--compact")
+	{
+		unsigned int quantizationBits = argc >= 6 ? atoi(argv[5]) : 16;
+		compact(argv[2], atoi(argv[3]), argv[4], quantizationBits);
+	}
+	else if (argc == 4 && string(argv[1]) == "--codegen")
+	{
+		ErcForest forest(argv[2]);
+		forest.saveCpp(argv[3]);
+		cout << "Saved the source of forest \"" << argv[2] << "\" to \"" << argv[3] << "\", build it with \"cl /O2 /LD " << argv[3] << "\"." << endl;
+	}
+	else if (argc == 6 && string(argv[1]) == "--verify")
+	{
+		if (!verifyCompiled(argv[2], argv[3], atoi(argv[4]), argv[5])) return 1;
+	}
+	else if (argc >= 6 && string(argv[1]) == "--tiled")
+	{
+		unsigned int tileSize = argc >= 7 ? atoi(argv[6]) : 1024;
+		testTiled(argv[2], argv[3], atoi(argv[4]), argv[5], tileSize);
+		exportTrace();
+	}
+	else if (argc == 3 && string(argv[1]) == "--resume")
+	{
+		resume(argv[2]);
+		exportTrace();
+	}
+	else if (argc >= 5 && string(argv[1]) == "--sharded")
+	{
+		vector<string> imageSearchPaths;
+		vector<string> maskSearchPaths;
+		readSearchPaths(argv[2], imageSearchPaths, maskSearchPaths);
+		unsigned int nTreesPerShard = argc >= 6 ? atoi(argv[5]) : 1;
+		bool useBagging = argc >= 7 && atoi(argv[6]) != 0;
+		unsigned int maxNProcesses = argc >= 8 ? atoi(argv[7]) : 0;
+		unsigned int maxNDescriptorsPerShard = argc >= 9 ? atoi(argv[8]) : defaultMaxNDescriptors;
+		trainSharded(imageSearchPaths, maskSearchPaths, atoi(argv[3]), 1000, atoi(argv[4]), nTreesPerShard, useBagging, maxNProcesses, maxNDescriptorsPerShard);
+		exportTrace();
+	}
+	else if (argc == 7 && string(argv[1]) == "--shard-worker")
+	{
+		Trace::enable(false);
+		return trainShard(argv[2], atoi(argv[3]), atoi(argv[4]), atoi(argv[5]), atoi(argv[6]) != 0);
+	}
+	else if (argc >= 6 && string(argv[1]) == "--update")
+	{
+		vector<string> imageSearchPaths;
+		vector<string> maskSearchPaths;
+		readSearchPaths(argv[4], imageSearchPaths, maskSearchPaths);
+		unsigned int maxNPictures = argc >= 7 ? atoi(argv[6]) : 1000;
+		unsigned int maxNDescriptors = argc >= 8 ? atoi(argv[7]) : defaultMaxNDescriptors;
+		update(argv[2], argv[3], imageSearchPaths, maskSearchPaths, atoi(argv[5]), maxNPictures, maxNDescriptors);
+		exportTrace();
+	}
+	else if ((argc == 2 || argc == 3) && argv[1][0] != '-')
 	{
 		vector<string> imageSearchPaths;
 		vector<string> maskSearchPaths;
 		cout << "Training model from paths in \"" << argv[1] << "\"" << endl;
-	
-		FILE *pathFile = fopen(argv[1], "r");
-		char line[MAX_PATH];
-		while (fgets(line, MAX_PATH, pathFile))
-		{		
-			if (line[strlen(line) - 1] == '\n') line[strlen(line) - 1] = '\0';
-			imageSearchPaths.push_back(string(line));
-			if (!fgets(line, MAX_PATH, pathFile)) 
-			{
-				maskSearchPaths.push_back("");
-				break;
-			}			
-			if (line[strlen(line) - 1] == '\n') line[strlen(line) - 1] = '\0';
-			maskSearchPaths.push_back(string(line));
-		}
-		fclose(pathFile);
+		readSearchPaths(argv[1], imageSearchPaths, maskSearchPaths);
 
 		unsigned int maxNPictures;
 		cout << "Number of images to use: ";
@@ -181,7 +781,10 @@ int main(unsigned int argc, char* argv[])
 		else if (featureType == 1) cout << "Using Haar transform of HSL." << endl;
 		else cout << "Using SIFT." << endl;
 
-		train(imageSearchPaths, maskSearchPaths, featureType, maxNPictures);
+		unsigned int maxNDescriptors = argc >= 3 ? atoi(argv[2]) : defaultMaxNDescriptors;
+		cout << "Sampling up to " << maxNDescriptors << " descriptors." << endl;
+		train(imageSearchPaths, maskSearchPaths, featureType, maxNPictures, maxNDescriptors);
+		exportTrace();
 	}
 	else if (argc == 4)
 	{
@@ -195,14 +798,34 @@ int main(unsigned int argc, char* argv[])
 		cin >> featureType;			
 		
 		test(forestPath, classifierPath, testImagePath, featureType);
+		exportTrace();
 	}
 	else
 	{
 		cout << "Usage" << endl << endl;
-		cout << "For training models to \"forest.xml\" and \"classifier.bin\" with image search paths indicated in \"paths.txt\" :" << endl;
-		cout << "ERCF.exe \"paths.txt\"" << endl << endl;
+		cout << "For training models to \"forest.xml\" and \"classifier.bin\" with image search paths indicated in \"paths.txt\" on up to d sampled descriptors, saving its stages to \"checkpoint\" :" << endl;
+		cout << "ERCF.exe \"paths.txt\" [d]" << endl << endl;
+		cout << "For training models from paths in \"paths.txt\" with feature type t in n worker processes of k trees each, on bootstrap samples of their shard if b is 1, at most p at a time, sampling d descriptors per worker :" << endl;
+		cout << "ERCF.exe --sharded \"paths.txt\" t n [k [b [p [d]]]]" << endl << endl;
+		cout << "For resuming an interrupted training from its stages saved in \"checkpoint\" :" << endl;
+		cout << "ERCF.exe --resume \"checkpoint\"" << endl << endl;
+		cout << "For refining models \"forest.xml\" and \"classifier.bin\" in place with up to n new images per class and d descriptors of feature type t from paths in \"paths.txt\" :" << endl;
+		cout << "ERCF.exe --update \"forest.xml\" \"clasifier.bin\" \"paths.txt\" t [n [d]]" << endl << endl;
 		cout << "For testing image \"image.jpg\" with models \"forest.xml\" and \"classifier.bin\" :" << endl;
 		cout << "ERCF.exe \"forest.xml\" \"clasifier.bin\" \"image.jpg\"" << endl << endl;
+		cout << "For serving models \"forest.xml\" and \"classifier.bin\" with feature type t on socket \"ercf.sock\" with n worker threads, scoring batches of at most b images gathered within d microseconds :" << endl;
+		cout << "ERCF.exe --serve \"forest.xml\" \"clasifier.bin\" t \"ercf.sock\" [n [b [d]]]" << endl << endl;
+		cout << "For testing a large image \"image.cimg\" with feature type t, extracting descriptors in tiles of s pixels on all cores :" << endl;
+		cout << "ERCF.exe --tiled \"forest.xml\" \"clasifier.bin\" t \"image.cimg\" [s]" << endl << endl;
+		cout << "For scoring the images matched by \"*.jpg\", or listed in \"images.txt\", with feature type t on n threads and writing \"scores.csv\" or \"scores.jsonl\" :" << endl;
+		cout << "ERCF.exe --batch \"forest.xml\" \"clasifier.bin\" t \"*.jpg\" \"scores.csv\" [n]" << endl << endl;
+		cout << "For compiling \"forest.xml\" to b-bit thresholds and counting the leaf assignments it changes on feature type t of \"*.jpg\" :" << endl;
+		cout << "ERCF.exe --compact \"forest.xml\" t \"*.jpg\" [b]" << endl << endl;
+		cout << "For generating the source \"forest.cpp\" of a DLL classifying with \"forest.xml\" compiled to branches :" << endl;
+		cout << "ERCF.exe --codegen \"forest.xml\" \"forest.cpp\"" << endl << endl;
+		cout << "For checking that \"forest.dll\" built from it matches \"forest.xml\" on feature type t of \"*.jpg\" :" << endl;
+		cout << "ERCF.exe --verify \"forest.xml\" \"forest.dll\" t \"*.jpg\"" << endl << endl;
+		cout << "Setting the environment variable ERCF_TRACE writes the spans of training and testing to \"trace.json\" and prints their summary." << endl;
 	}
 
 	return 0;
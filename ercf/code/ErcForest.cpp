@@ -3,7 +3,7 @@
 
 using namespace ercf;
 
-ErcForest::ErcForest(unsigned int size)
+ErcForest::ErcForest(unsigned int size) : _approxMinNPoints(0), _nBins(0), _subsampleMaxNPoints(0), _subsampleFraction(1.), _baggingFraction(0.), _seed(999)
 {	
 	_trees.assign(size, ErcTree());
 	for (unsigned int i = 0; i < size; ++i)
@@ -16,13 +16,54 @@ ErcForest::~ErcForest(void)
 {
 }
 
-void ErcForest::train(TrainingSet &set, double sMin, unsigned int tMax)
+void ErcForest::setApproximateSplits(unsigned int minNPoints, unsigned int nBins)
 {
-	_featureIndexGen.assign(0, set.getFeatureDim() - 1);	
-	for (unsigned int i = 0; i < _trees.size(); ++i)
+	_approxMinNPoints = minNPoints;
+	_nBins = nBins;
+}
+
+/*! See ErcTree::setSplitSubsample. */
+void ErcForest::setSplitSubsample(unsigned int maxNPoints, double fraction)
+{
+	_subsampleMaxNPoints = maxNPoints;
+	_subsampleFraction = fraction;
+}
+
+/*! Trains each tree on its own bootstrap sample of fraction times the points of the training set, 0 to train every tree on all of them. 
+ *  A sample only holds point indices into the shared feature matrix. */
+void ErcForest::setBagging(double fraction)
+{
+	_baggingFraction = fraction;
+}
+
+/*! Base seed of the draws of the trees, tree i drawing its features, thresholds and bootstrap sample from seed + i, so that a tree 
+ *  does not depend on the trees trained before it. A process training the trees of another forest from its tree first on sets it 
+ *  to 999 + first, so that they are the trees that forest would have. */
+void ErcForest::setSeed(int seed)
+{
+	_seed = seed;
+}
+
+/*! Trains the trees from firstTree on, the previous ones being already trained, and calls onTreeTrained after each of them. 
+ *  Each tree is seeded on its own, so that resuming from firstTree trains the trees an uninterrupted run would have. */
+void ErcForest::train(TrainingSet &set, double sMin, unsigned int tMax, unsigned int firstTree, const function<void(unsigned int)> &onTreeTrained)
+{
+	if (_approxMinNPoints > 0 && set.getNBins() != _nBins) set.setNBins(_nBins);
+	for (unsigned int i = firstTree; i < _trees.size(); ++i)
 	{
-		_trees[i].train(set, sMin, tMax);
+		_featureIndexGen.assign(0, set.getFeatureDim() - 1, _seed + i);
+		RandomDouble::seedDefault(_seed + i);
+		_trees[i].setApproximateSplits(_approxMinNPoints);
+		_trees[i].setSplitSubsample(_subsampleMaxNPoints, _subsampleFraction);
+		if (_baggingFraction > 0.)
+		{
+			TrainingSet bag(set);
+			set.sample(max((unsigned int)(_baggingFraction * set.getNPoints()), 1U), bag);
+			_trees[i].train(bag, sMin, tMax);
+		}
+		else _trees[i].train(set, sMin, tMax);
 		_trees[i].verbose = verbose;
+		if (onTreeTrained) onTreeTrained(i);
 	}
 	if (verbose)
 	{
@@ -34,6 +75,26 @@ void ErcForest::train(TrainingSet &set, double sMin, unsigned int tMax)
 	
 }
 
+/*! Updates every tree with the points of set and prunes it back to maxNLeaves, see ErcTree::update. For each histogram bin of the 
+ *  updated forest, leafOrigins gets the histogram bin of the leaf it grew from, so that a Classifier of the previous forest can carry 
+ *  its weights over. */
+void ErcForest::update(const TrainingSet &set, unsigned int minNPoints, double sMin, unsigned int tMax, unsigned int maxNLeaves, vector<unsigned int> &leafOrigins)
+{
+	leafOrigins.clear();
+	unsigned int histOffset = 0;
+	for (unsigned int i = 0; i < _trees.size(); ++i)
+	{
+		_featureIndexGen.assign(0, set.getFeatureDim() - 1, _seed + i);
+		RandomDouble::seedDefault(_seed + i);
+		unsigned int nLeaves = _trees[i].getNLeaves();
+		vector<unsigned int> treeLeafOrigins;
+		_trees[i].update(set, &_featureIndexGen, minNPoints, sMin, tMax, maxNLeaves, treeLeafOrigins);
+		for (unsigned int l = 0; l < treeLeafOrigins.size(); ++l) leafOrigins.push_back(histOffset + treeLeafOrigins[l]);
+		histOffset += nLeaves;
+		if (verbose) cout << "Tree " << i << " updated: " << nLeaves << " -> " << _trees[i].getNLeaves() << " leaves" << endl;
+	}
+}
+
 unsigned int ErcForest::getNLeaves(void) const
 {
 	unsigned int n = 0;
@@ -44,26 +105,25 @@ unsigned int ErcForest::getNLeaves(void) const
 	return n;
 }
 
-void ErcForest::classify(double *histogram, const CImg<double> &feature) const
+unsigned int ErcForest::getNTrees(void) const
 {
-	unsigned int histOffset = 0;
-	for (unsigned int t = 0; t < _trees.size(); ++t)		
-	{
-		histogram[histOffset + _trees[t].test(feature)->getLeafIndex()] += 1.;
-		histOffset += _trees[t].getNLeaves();
-	}
+	return _trees.size();
 }
 
-bool ErcForest::isUnmixed(const CImg<double> &feature, unsigned int unmixedLabel) const
+/*! Number of labels in the leaf distributions, 0 if the forest was loaded without them. */
+unsigned int ErcForest::getNLabels(void) const
 {
-	bool test = false;
-	for (unsigned int i = 0; i < _trees.size(); ++i)
+	unsigned int nLabels = 0;
+	for (unsigned int t = 0; t < _trees.size(); ++t)
 	{
-		if(_trees[i].test(feature)->isUnmixed() && (_trees[i].test(feature)->getUnmixedLabel() == unmixedLabel)) return true;
-		//test &= _trees[i].test(feature)->isUnmixed() && (_trees[i].test(feature)->getUnmixedLabel() == unmixedLabel);
+		nLabels = max(nLabels, _trees[t].getNLabels());
 	}
-	return false;
-	//return test;
+	return nLabels;
+}
+
+const ErcTree &ErcForest::getTree(unsigned int t) const
+{
+	return _trees[t];
 }
 
 void ErcForest::prune(unsigned int maxNLeaves)
@@ -94,13 +154,14 @@ string ErcForest::xml(void) const
 	return output.str();
 }
 
-ErcForest::ErcForest(string xmlFile)
+ErcForest::ErcForest(string xmlFile) : _approxMinNPoints(0), _nBins(0), _subsampleMaxNPoints(0), _subsampleFraction(1.), _baggingFraction(0.), _seed(999), verbose(false)
 {
 	TiXmlDocument doc(xmlFile.c_str());
 	doc.LoadFile();
 
 	TiXmlHandle docHandle(&doc);
 	TiXmlElement *root = docHandle.FirstChildElement("forest").Element();
+	if (root == NULL) return;
 	unsigned int n = 0;	
 	for(TiXmlElement *element = root->FirstChildElement(); element; element = element->NextSiblingElement())
 	{		
@@ -130,4 +191,57 @@ void ErcForest::save(string xmlFile) const
 	file.open(xmlFile.c_str(), ios::trunc);
 	file << xml();
 	file.close();
+}
+
+/*! Reads tree t from the binary format of ErcTree::write. */
+void ErcForest::readTree(unsigned int t, istream &input)
+{
+	_trees[t].read(input);
+}
+
+void ErcForest::writeTree(unsigned int t, ostream &output) const
+{
+	_trees[t].write(output);
+}
+
+/*! Source of a DLL exporting ercfNTrees, ercfNLeaves, ercfClassify and ercfLeafIndices, the latter two doing what classify and getLeafIndices 
+ *  do with every tree compiled to branches.
+ *  Build it with "cl /O2 /LD forest.cpp" and load it with CompiledForest. */
+string ErcForest::cpp(void) const
+{
+	stringstream output;
+	output << "// Generated from a forest of " << _trees.size() << " trees and " << getNLeaves() << " leaves.\n\n";
+	output << "extern \"C\"\n{\n\n";
+	for (unsigned int t = 0; t < _trees.size(); ++t)
+	{
+		unsigned int nodeIndex = 0;
+		output << "static unsigned int tree" << t << "(const double *f)\n{\n" << _trees[t].cpp(nodeIndex) << "}\n\n";
+	}
+	output << "__declspec(dllexport) unsigned int ercfNTrees(void)\n{\n\treturn " << _trees.size() << ";\n}\n\n";
+	output << "__declspec(dllexport) unsigned int ercfNLeaves(void)\n{\n\treturn " << getNLeaves() << ";\n}\n\n";
+	output << "__declspec(dllexport) void ercfClassify(double *histogram, const double *feature)\n{\n";
+	unsigned int histOffset = 0;
+	for (unsigned int t = 0; t < _trees.size(); ++t)
+	{
+		output << "\thistogram[" << histOffset << " + tree" << t << "(feature)] += 1.;\n";
+		histOffset += _trees[t].getNLeaves();
+	}
+	output << "}\n\n";
+	output << "__declspec(dllexport) void ercfLeafIndices(unsigned int *leafIndices, const double *feature)\n{\n";
+	histOffset = 0;
+	for (unsigned int t = 0; t < _trees.size(); ++t)
+	{
+		output << "\tleafIndices[" << t << "] = " << histOffset << " + tree" << t << "(feature);\n";
+		histOffset += _trees[t].getNLeaves();
+	}
+	output << "}\n\n}\n";
+	return output.str();
+}
+
+void ErcForest::saveCpp(string cppFile) const
+{
+	ofstream file;
+	file.open(cppFile.c_str(), ios::trunc);
+	file << cpp();
+	file.close();
 }
\ No newline at end of file
@@ -13,6 +13,12 @@ namespace ercf
 	private:
 		vector<ErcTree> _trees;
 		RandomInt _featureIndexGen;
+		unsigned int _approxMinNPoints;
+		unsigned int _nBins;
+		unsigned int _subsampleMaxNPoints;
+		double _subsampleFraction;
+		double _baggingFraction;
+		int _seed;
 
 	public:
 		ErcForest::ErcForest(string xmlFile);
@@ -20,14 +26,76 @@ namespace ercf
 		~ErcForest(void);
 
 		unsigned int getNLeaves(void) const;
-		void train(TrainingSet &set, double sMin, unsigned int tMax);
-		void classify(double *histogram, const CImg<double> &feature) const;
-		bool isUnmixed(const CImg<double> &feature, unsigned int unmixedLabel) const;
+		unsigned int getNTrees(void) const;
+		unsigned int getNLabels(void) const;
+		const ErcTree &getTree(unsigned int t) const;
+		void train(TrainingSet &set, double sMin, unsigned int tMax, unsigned int firstTree = 0, const function<void(unsigned int)> &onTreeTrained = nullptr);
+		void update(const TrainingSet &set, unsigned int minNPoints, double sMin, unsigned int tMax, unsigned int maxNLeaves, vector<unsigned int> &leafOrigins);
+		void setApproximateSplits(unsigned int minNPoints, unsigned int nBins = 64);
+		void setSplitSubsample(unsigned int maxNPoints, double fraction = 1.);
+		void setBagging(double fraction);
+		void setSeed(int seed);
+		template<typename T> void classify(double *histogram, const CImg<T> &feature) const;
+		template<typename T> void getLeafIndices(unsigned int *leafIndices, const CImg<T> &feature) const;
+		template<typename T> bool isUnmixed(const CImg<T> &feature, unsigned int unmixedLabel) const;
+		template<typename T> void vote(double *posterior, const CImg<T> &feature) const;
 		void prune(unsigned int maxNLeaves);
 		string xml(void) const;
 		void save(string xmlFile) const;
+		void readTree(unsigned int t, istream &input);
+		void writeTree(unsigned int t, ostream &output) const;
+		string cpp(void) const;
+		void saveCpp(string cppFile) const;
 		bool verbose;
 	};
 
-}
+	template<typename T>
+	void ErcForest::classify(double *histogram, const CImg<T> &feature) const
+	{
+		unsigned int histOffset = 0;
+		for (unsigned int t = 0; t < _trees.size(); ++t)		
+		{
+			histogram[histOffset + _trees[t].test(feature)->getLeafIndex()] += 1.;
+			histOffset += _trees[t].getNLeaves();
+		}
+	}
 
+	/*! Histogram index of the leaf reached by feature in each tree. */
+	template<typename T>
+	void ErcForest::getLeafIndices(unsigned int *leafIndices, const CImg<T> &feature) const
+	{
+		unsigned int histOffset = 0;
+		for (unsigned int t = 0; t < _trees.size(); ++t)		
+		{
+			leafIndices[t] = histOffset + _trees[t].test(feature)->getLeafIndex();
+			histOffset += _trees[t].getNLeaves();
+		}
+	}
+
+	template<typename T>
+	bool ErcForest::isUnmixed(const CImg<T> &feature, unsigned int unmixedLabel) const
+	{
+		for (unsigned int i = 0; i < _trees.size(); ++i)
+		{
+			const ErcTree *leaf = _trees[i].test(feature);
+			if (leaf->isUnmixed() && (leaf->getUnmixedLabel() == unmixedLabel)) return true;
+		}
+		return false;
+	}
+
+	/*! Adds to posterior, getNLabels() values, the label distributions of the leaves reached by feature in every tree. */
+	template<typename T>
+	void ErcForest::vote(double *posterior, const CImg<T> &feature) const
+	{
+		for (unsigned int t = 0; t < _trees.size(); ++t)
+		{
+			const float *leafPosterior = _trees[t].test(feature)->getPosterior();
+			if (leafPosterior == NULL) continue;
+			for (unsigned int l = 0; l < _trees[t].getNLabels(); ++l)
+			{
+				posterior[l] += leafPosterior[l];
+			}
+		}
+	}
+
+}
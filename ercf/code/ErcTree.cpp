@@ -3,27 +3,37 @@
 
 using namespace ercf;
 
-ErcTree::ErcTree(void)
+ErcTree::ErcTree(void) : _leaves(NULL), _arena(NULL), _posteriors(NULL), _posteriorIndex(noNode), _nPoints(0)
 {	
-	_leftChild = NULL;
-	_rightChild = NULL;
 	_parent = NULL;
-	_leaves = new vector<ErcTree *>();
 	_featureIndexGen = NULL;
+	_approxMinNPoints = 0;
+	_subsampleMaxNPoints = 0;
+	_subsampleFraction = 1.;
+	_initRoot();
 	leaf();
 }
 
-ErcTree::ErcTree(const TiXmlElement *xmlElement, ErcTree *parent)
+ErcTree::ErcTree(const TiXmlElement *xmlElement, ErcTree *parent) : _leaves(NULL), _arena(NULL), _posteriors(NULL), _posteriorIndex(noNode), _nPoints(0)
 {
 	assign(xmlElement, parent);
 }
 
 void ErcTree::assign(const TiXmlElement *xmlElement, ErcTree *parent)
 {
-	_leftChild = NULL;
-	_rightChild = NULL;
+	_approxMinNPoints = 0;
+	_subsampleMaxNPoints = 0;
+	_subsampleFraction = 1.;
 	_parent = parent;
-	_leaves = (parent == NULL) ? new vector<ErcTree *>() : parent->getLeaves();
+	if (parent == NULL) _initRoot();
+	else 
+	{
+		_leaves = parent->getLeaves();
+		_arena = parent->_arena;
+		_posteriors = parent->_posteriors;
+	}
+	_posteriorIndex = noNode;
+	_nPoints = 0;
 	leaf();
 	if (xmlElement->NoChildren())
 	{
@@ -39,6 +49,18 @@ void ErcTree::assign(const TiXmlElement *xmlElement, ErcTree *parent)
 			xmlElement->QueryIntAttribute("label", &unmixedLabel);
 			_unmixedLabel = (unsigned int)unmixedLabel;
 		}
+		int nPoints = 0;
+		xmlElement->QueryIntAttribute("points", &nPoints);
+		_nPoints = (unsigned int)nPoints;
+		const char *posterior = xmlElement->Attribute("posterior");
+		if (posterior != NULL)
+		{
+			stringstream input(posterior);
+			_posteriorIndex = _posteriors->values.size();
+			float p;
+			while (input >> p) _posteriors->values.push_back(p);
+			_posteriors->nLabels = _posteriors->values.size() - _posteriorIndex;
+		}
 	}
 	else
 	{
@@ -48,8 +70,10 @@ void ErcTree::assign(const TiXmlElement *xmlElement, ErcTree *parent)
 		xmlElement->QueryDoubleAttribute("testThreshold", &_testThreshold);
 		xmlElement->QueryDoubleAttribute("score", &_score);
 
-		_leftChild = new ErcTree(xmlElement->FirstChild()->ToElement(), this);
-		_rightChild = new ErcTree(xmlElement->LastChild()->ToElement(), this);	
+		_leftChildIndex = _arena->allocate();
+		new ((*_arena)[_leftChildIndex]) ErcTree(xmlElement->FirstChild()->ToElement(), this);
+		_rightChildIndex = _arena->allocate();
+		new ((*_arena)[_rightChildIndex]) ErcTree(xmlElement->LastChild()->ToElement(), this);
 
 		_isLeaf = false;
 	}
@@ -57,66 +81,176 @@ void ErcTree::assign(const TiXmlElement *xmlElement, ErcTree *parent)
 	if (isRoot()) computeGlobalProperties();
 }
 
-ErcTree::ErcTree(const ErcTree &tree)
+ErcTree::ErcTree(istream &input, ErcTree *parent) : _leaves(NULL), _arena(NULL), _posteriors(NULL), _posteriorIndex(noNode), _nPoints(0)
 {
-	_leftChild = NULL;
-	_rightChild = NULL;
+	_featureIndexGen = parent->_featureIndexGen;
+	read(input, parent);
+}
+
+/*! Reads a tree written by write, with everything training left in its nodes, so that it can still be pruned or updated. */
+void ErcTree::read(istream &input, ErcTree *parent)
+{
+	_approxMinNPoints = (parent == NULL) ? _approxMinNPoints : parent->_approxMinNPoints;
+	_subsampleMaxNPoints = (parent == NULL) ? _subsampleMaxNPoints : parent->_subsampleMaxNPoints;
+	_subsampleFraction = (parent == NULL) ? _subsampleFraction : parent->_subsampleFraction;
+	_parent = parent;
+	if (parent == NULL) 
+	{
+		_initRoot();
+		input.read((char *) &_posteriors->nLabels, sizeof(unsigned int));
+	}
+	else 
+	{
+		_leaves = parent->getLeaves();
+		_arena = parent->_arena;
+		_posteriors = parent->_posteriors;
+	}
+	leaf();
+
+	// A truncated file stops the recursion at the node it ends in, and leaves input failed for the caller to check
+	unsigned char isLeaf = 1, isUnmixed = 0, hasPosterior = 0;
+	input.read((char *) &isLeaf, 1);
+	input.read((char *) &isUnmixed, 1);
+	input.read((char *) &_unmixedLabel, sizeof(unsigned int));
+	input.read((char *) &_nPoints, sizeof(unsigned int));
+	input.read((char *) &hasPosterior, 1);
+	_isUnmixed = (isUnmixed != 0);
+	_posteriorIndex = noNode;
+	if (!input) return;
+	if (hasPosterior)
+	{
+		_posteriorIndex = _posteriors->values.size();
+		_posteriors->values.resize(_posteriorIndex + _posteriors->nLabels);
+		input.read((char *) (_posteriors->values.data() + _posteriorIndex), _posteriors->nLabels * sizeof(float));
+	}
+	if (!isLeaf)
+	{
+		input.read((char *) &_score, sizeof(double));
+		input.read((char *) &_testFeatureIndex, sizeof(unsigned int));
+		input.read((char *) &_testThreshold, sizeof(double));
+
+		_leftChildIndex = _arena->allocate();
+		new ((*_arena)[_leftChildIndex]) ErcTree(input, this);
+		_rightChildIndex = _arena->allocate();
+		new ((*_arena)[_rightChildIndex]) ErcTree(input, this);
+
+		_isLeaf = false;
+	}
+
+	if (isRoot()) computeGlobalProperties();
+}
+
+/*! Writes the tree in preorder, unlike xml keeping the score, unmixed label, point count and label distribution of every node. */
+void ErcTree::write(ostream &output) const
+{
+	if (isRoot()) output.write((const char *) &_posteriors->nLabels, sizeof(unsigned int));
+
+	unsigned char isLeaf = _isLeaf;
+	unsigned char isUnmixed = _isUnmixed;
+	unsigned char hasPosterior = (getPosterior() != NULL);
+	output.write((const char *) &isLeaf, 1);
+	output.write((const char *) &isUnmixed, 1);
+	output.write((const char *) &_unmixedLabel, sizeof(unsigned int));
+	output.write((const char *) &_nPoints, sizeof(unsigned int));
+	output.write((const char *) &hasPosterior, 1);
+	if (hasPosterior) output.write((const char *) getPosterior(), _posteriors->nLabels * sizeof(float));
+	if (!isLeaf)
+	{
+		output.write((const char *) &_score, sizeof(double));
+		output.write((const char *) &_testFeatureIndex, sizeof(unsigned int));
+		output.write((const char *) &_testThreshold, sizeof(double));
+		_getLeftChild()->write(output);
+		_getRightChild()->write(output);
+	}
+}
+
+ErcTree::ErcTree(const ErcTree &tree) : _leaves(NULL), _arena(NULL), _posteriors(NULL), _posteriorIndex(noNode), _nPoints(0)
+{
+	_approxMinNPoints = tree._approxMinNPoints;
+	_subsampleMaxNPoints = tree._subsampleMaxNPoints;
+	_subsampleFraction = tree._subsampleFraction;
 	_parent = NULL;
-	_leaves = new vector<ErcTree *>();
+	_initRoot();
 	leaf();
 }
 
-ErcTree::ErcTree(ErcTree &tree, bool asChild)
+ErcTree::ErcTree(ErcTree &tree, bool asChild) : _leaves(NULL), _arena(NULL), _posteriors(NULL), _posteriorIndex(noNode), _nPoints(0)
 {
 	_featureIndexGen = tree._featureIndexGen;
-	_leftChild = NULL;
-	_rightChild = NULL;
+	_approxMinNPoints = tree._approxMinNPoints;
+	_subsampleMaxNPoints = tree._subsampleMaxNPoints;
+	_subsampleFraction = tree._subsampleFraction;
 	_parent = NULL;
-	leaf();
 	if (asChild)
 	{
 		_parent = &tree;
 		_leaves = tree._leaves;
+		_arena = tree._arena;
+		_posteriors = tree._posteriors;
 	}
+	else _initRoot();
+	leaf();
 }
 
-ErcTree::ErcTree(const RandomInt *featureIndexGen, ErcTree *parent): _featureIndexGen(featureIndexGen), _parent(parent), _leaves(parent->getLeaves())
+ErcTree::ErcTree(const RandomInt *featureIndexGen, ErcTree *parent): _featureIndexGen(featureIndexGen), _parent(parent), _leaves(parent->getLeaves()), _arena(parent->_arena), _posteriors(parent->_posteriors), _posteriorIndex(noNode), _nPoints(0), _approxMinNPoints(parent->_approxMinNPoints), _subsampleMaxNPoints(parent->_subsampleMaxNPoints), _subsampleFraction(parent->_subsampleFraction)
 {
-	_leftChild = NULL;
-	_rightChild = NULL;
 	leaf();
 }
 
 ErcTree::~ErcTree(void)
 {
-	leaf();
-	if (isRoot()) delete _leaves;
+	if (isRoot()) 
+	{
+		delete _leaves;
+		delete _arena;
+		delete _posteriors;
+	}
 }
 
 void ErcTree::assign(const RandomInt *featureIndexGen, ErcTree *parent)
 {
 	_featureIndexGen = featureIndexGen;
+	_approxMinNPoints = (parent == NULL) ? 0 : parent->_approxMinNPoints;
+	_subsampleMaxNPoints = (parent == NULL) ? 0 : parent->_subsampleMaxNPoints;
+	_subsampleFraction = (parent == NULL) ? 1. : parent->_subsampleFraction;
 	_parent = parent;
-	_leaves = (parent == NULL) ? new vector<ErcTree *>() : parent->getLeaves();
-	_leftChild = NULL;
-	_rightChild = NULL;
+	if (parent == NULL) _initRoot();
+	else 
+	{
+		_leaves = parent->getLeaves();
+		_arena = parent->_arena;
+		_posteriors = parent->_posteriors;
+	}
+	_posteriorIndex = noNode;
+	_nPoints = 0;
 	leaf();
 }
 
+void ErcTree::_initRoot(void)
+{
+	if (_leaves == NULL) _leaves = new vector<ErcTree *>();
+	if (_arena == NULL) _arena = new Arena<ErcTree>();
+	if (_posteriors == NULL) _posteriors = new Posteriors();
+	_leaves->clear();
+	_arena->clear();
+	_posteriors->nLabels = 0;
+	_posteriors->values.clear();
+}
+
+ErcTree *ErcTree::_getLeftChild(void) const
+{
+	return (_leftChildIndex == noNode) ? NULL : (*_arena)[_leftChildIndex];
+}
+
+ErcTree *ErcTree::_getRightChild(void) const
+{
+	return (_rightChildIndex == noNode) ? NULL : (*_arena)[_rightChildIndex];
+}
+
 void ErcTree::leaf(void)
 {
-	if (_leftChild != NULL)
-	{
-		_leftChild->leaf();
-		free(_leftChild);
-		_leftChild = NULL;
-	}
-	if (_rightChild != NULL)
-	{
-		_rightChild->leaf();	
-		free(_rightChild);
-		_rightChild = NULL;
-	}
+	_leftChildIndex = noNode;
+	_rightChildIndex = noNode;
 	_weakestFinalNode  = NULL;
 	_nLeaves = 1;
 	_score = 0.;
@@ -130,6 +264,137 @@ double ErcTree::getPartitionScore(double entropy1, double entropy2, double joint
 	return (entropy1 + entropy2 == 0.) ? 0. : (2 * (1 - (jointEntropy / (entropy1 + entropy2))));
 }
 
+/*! Same score from the label counts on each side of a split, as laid out by TrainingSet::evaluateSplits: with all entropies 
+ *  scaled by the number of points N, they share N log(N) and the score costs one table lookup per count and a division. */
+double ErcTree::getPartitionScore(double labelEntropy, const unsigned int *labelSetOccurences, unsigned int nLabels)
+{
+	unsigned int nPoints1 = 0;
+	unsigned int nPoints2 = 0;
+	double sum = 0.;
+	for (unsigned int l = 0; l < nLabels; ++l)
+	{
+		nPoints1 += labelSetOccurences[l];
+		nPoints2 += labelSetOccurences[l + nLabels];
+		sum += TrainingSet::nLogN(labelSetOccurences[l]) + TrainingSet::nLogN(labelSetOccurences[l + nLabels]);
+	}
+	unsigned int nPoints = nPoints1 + nPoints2;
+	double nLogN = TrainingSet::nLogN(nPoints);
+	double scaledEntropies = nPoints * labelEntropy + nLogN - TrainingSet::nLogN(nPoints1) - TrainingSet::nLogN(nPoints2);
+	return (scaledEntropies <= 0.) ? 0. : (2 * (1 - ((nLogN - sum) / scaledEntropies)));
+}
+
+void ErcTree::setApproximateSplits(unsigned int minNPoints)
+{
+	_approxMinNPoints = minNPoints;
+}
+
+/*! Scores the candidate splits of nodes on a random sample of at most maxNPoints (0 for no cap) and fraction of their points, 
+ *  and only partitions all of them with the winning test, so that the cost of the split trials stops growing with the node. */
+void ErcTree::setSplitSubsample(unsigned int maxNPoints, double fraction)
+{
+	_subsampleMaxNPoints = maxNPoints;
+	_subsampleFraction = fraction;
+}
+
+unsigned int ErcTree::_getSubsampleSize(unsigned int nPoints) const
+{
+	unsigned int n = nPoints;
+	if (_subsampleFraction < 1.) n = max((unsigned int)ceil(_subsampleFraction * nPoints), 1U);
+	if (_subsampleMaxNPoints > 0) n = min(n, _subsampleMaxNPoints);
+	return n;
+}
+
+unsigned int ErcTree::_trainBatchedSplit(TrainingSet &set, double entropy, double sMin, unsigned int tMax)
+{
+	unsigned int nLabels = set.getNLabels();
+	unsigned int testFeatureIndices[splitBatchSize];
+	double testThresholds[splitBatchSize];
+	vector<unsigned int> labelSetOccurences(splitBatchSize * 2 * nLabels);
+	unsigned int nTrials = 0;
+	unsigned int t = 0;
+	bool isDone = false;
+	while (!isDone)
+	{
+		unsigned int nCandidates = tMax + 1 - t;
+		if (nCandidates > splitBatchSize) nCandidates = splitBatchSize;
+		for (unsigned int k = 0; k < nCandidates; ++k)
+		{
+			testFeatureIndices[k] = _featureIndexGen->operator()();
+		}
+		set.computeMinMaxFeatures(testFeatureIndices, nCandidates);
+		for (unsigned int k = 0; k < nCandidates; ++k)
+		{
+			double testFeatureMin = set.getMinFeature(testFeatureIndices[k]);
+			double testFeatureMax = set.getMaxFeature(testFeatureIndices[k]);
+			testThresholds[k] = testFeatureMin + RandomDouble::Default() * (testFeatureMax - testFeatureMin);
+			if (set.isIntegral()) testThresholds[k] = ceil(testThresholds[k]);
+		}
+
+		set.evaluateSplits(testFeatureIndices, testThresholds, nCandidates, labelSetOccurences.data());
+
+		for (unsigned int k = 0; k < nCandidates && !isDone; ++k)
+		{
+			double score = getPartitionScore(entropy, labelSetOccurences.data() + k * 2 * nLabels, nLabels);
+			++nTrials;
+
+			if (score >= _score || t == 0)
+			{
+				_score = score;
+				_testFeatureIndex = testFeatureIndices[k];
+				_testThreshold = testThresholds[k];
+			}
+			isDone = !(_score < sMin && ++t <= tMax);
+		}
+	}
+	return nTrials;
+}
+
+unsigned int ErcTree::_trainHistogramSplit(TrainingSet &set, double entropy, double sMin, unsigned int tMax)
+{
+	unsigned int nLabels = set.getNLabels();
+	unsigned int nBins = set.getNBins();
+	vector<unsigned int> labelSetOccurences(2 * nLabels);
+	unsigned int nTrials = 0;
+	unsigned int t = 0;
+	do
+	{
+		unsigned int testFeatureIndex = _featureIndexGen->operator()();
+		const CImg<unsigned int> &histogram = set.getHistogram(testFeatureIndex);
+
+		int firstBin = nBins;
+		int lastBin = -1;
+		for (unsigned int b = 0; b < nBins; ++b)
+		{
+			unsigned int n = 0;
+			for (unsigned int l = 0; l < nLabels; ++l) n += histogram(b, l);
+			if (n == 0) continue;
+			firstBin = min(firstBin, (int)b);
+			lastBin = b;
+		}
+		unsigned int testBin = firstBin + 1 + (unsigned int)(RandomDouble::Default() * (lastBin - firstBin));
+		testBin = min(testBin, (unsigned int)max(lastBin, firstBin));
+
+		for (unsigned int l = 0; l < nLabels; ++l)
+		{
+			unsigned int n1 = 0;
+			for (unsigned int b = 0; b < testBin; ++b) n1 += histogram(b, l);
+			labelSetOccurences[l] = n1;
+			labelSetOccurences[l + nLabels] = set.getLabelOccurences(l) - n1;
+		}
+		double score = getPartitionScore(entropy, labelSetOccurences.data(), nLabels);
+		++nTrials;
+
+		if (score >= _score || t == 0)
+		{
+			_score = score;
+			_testFeatureIndex = testFeatureIndex;
+			_testThreshold = set.getBinThreshold(testFeatureIndex, testBin);
+			if (set.isIntegral()) _testThreshold = ceil(_testThreshold);
+		}
+	} while (_score < sMin && ++t <= tMax);
+	return nTrials;
+}
+
 void ErcTree::train(TrainingSet &set, double sMin, unsigned int tMax)
 {
 	_isUnmixed = (!isRoot() && (_parent->isUnmixed())) ? true : set.isUnmixed();
@@ -137,6 +402,13 @@ void ErcTree::train(TrainingSet &set, double sMin, unsigned int tMax)
 
 	if (verbose) cout << "Training tree with " << set.getNPoints() << " points... ";
 	leaf();
+	if (isRoot()) 
+	{
+		_arena->clear();
+		_posteriors->nLabels = set.getNLabels();
+		_posteriors->values.clear();
+	}
+	_recordPosterior(set);
 
 	if (set.isIndivisible()) 
 	{
@@ -147,30 +419,26 @@ void ErcTree::train(TrainingSet &set, double sMin, unsigned int tMax)
 	TrainingSet set1(set);
 	TrainingSet set2(set);
 	double entropy = set.getLabelEntropy();
-	unsigned int testFeatureIndex;
-	double testThreshold;
 
-	
-	unsigned int t = 0;
-	do
+	unsigned int nTrials;
 	{
-		double score;
-		testFeatureIndex = _featureIndexGen->operator()();
-		double testFeatureMin = set.getMinFeature(testFeatureIndex);
-		double testFeatureMax = set.getMaxFeature(testFeatureIndex);
-		testThreshold = testFeatureMin + RandomDouble::Default() * (testFeatureMax - testFeatureMin);
-
-		set.partition(testFeatureIndex, testThreshold, set1, set2);
-
-		score = getPartitionScore(entropy, TrainingSet::getPartitionEntropy(set1, set2), TrainingSet::getLabelPartitionJointEntropy(set1, set2));
-
-		if (score >=_score || t == 0)
+		traceScope("split-eval");
+		unsigned int nSampledPoints = _getSubsampleSize(set.getNPoints());
+		if (nSampledPoints < set.getNPoints())
 		{
-			_score = score;
-			_testFeatureIndex = testFeatureIndex;
-			_testThreshold = testThreshold;
+			TrainingSet sample(set);
+			set.sample(nSampledPoints, sample);
+			nTrials = _trainBatchedSplit(sample, sample.getLabelEntropy(), sMin, tMax);
 		}
-	} while (_score < sMin && ++t <= tMax);
+		else if (_approxMinNPoints > 0 && set.getNBins() > 0 && set.getNPoints() >= _approxMinNPoints) nTrials = _trainHistogramSplit(set, entropy, sMin, tMax);
+		else nTrials = _trainBatchedSplit(set, entropy, sMin, tMax);
+	}
+	Trace::counter("split trials", nTrials);
+
+	{
+		traceScope("partition");
+		set.partition(_testFeatureIndex, _testThreshold, set1, set2);
+	}
 
 	if (set1.getNPoints() == 0 || set2.getNPoints() == 0)
 	{
@@ -186,22 +454,144 @@ void ErcTree::train(TrainingSet &set, double sMin, unsigned int tMax)
 		}
 
 
-		_leftChild = new ErcTree(*this, true);
-		_rightChild = new ErcTree(*this, true);
+		_leftChildIndex = _arena->allocate();
+		new ((*_arena)[_leftChildIndex]) ErcTree(*this, true);
+		_rightChildIndex = _arena->allocate();
+		new ((*_arena)[_rightChildIndex]) ErcTree(*this, true);
 
 		_isLeaf = false;
 
-		set.partition(_testFeatureIndex, _testThreshold, set1, set2);
-
-		_leftChild->train(set1, sMin, tMax);
+		_getLeftChild()->train(set1, sMin, tMax);
 
-		_rightChild->train(set2, sMin, tMax);
+		_getRightChild()->train(set2, sMin, tMax);
 	
 		_isUnmixed = set.isUnmixed();
 	}
 	if (isRoot()) computeGlobalProperties();
 }
 
+/*! Keeps the label distribution of the points reaching this node, which stays valid if pruning makes it a leaf. */
+void ErcTree::_recordPosterior(const TrainingSet &set)
+{
+	_nPoints = set.getNPoints();
+	_posteriorIndex = _posteriors->values.size();
+	for (unsigned int l = 0; l < set.getNLabels(); ++l)
+	{
+		_posteriors->values.push_back(set.getLabelOccurences(l) / (float)set.getNPoints());
+	}
+}
+
+/*! Adds the points of set to the label distribution of the node, weighted by the number of points it was computed from. 
+ *  Trees saved without these counts give their distributions no weight. */
+void ErcTree::_mergePosterior(const TrainingSet &set)
+{
+	if (getPosterior() == NULL)
+	{
+		unsigned int nPoints = _nPoints;
+		_recordPosterior(set);
+		_nPoints += nPoints;
+		return;
+	}
+	float *posterior = _posteriors->values.data() + _posteriorIndex;
+	for (unsigned int l = 0; l < _posteriors->nLabels; ++l)
+	{
+		posterior[l] = (posterior[l] * _nPoints + set.getLabelOccurences(l)) / (float)(_nPoints + set.getNPoints());
+	}
+	_nPoints += set.getNPoints();
+}
+
+/*! Clears the unmixed flag of the node and of its ancestors, once points of another label reached it. */
+void ErcTree::_setMixed(void)
+{
+	for (ErcTree *node = this; node != NULL && node->_isUnmixed; node = node->_parent) node->_isUnmixed = false;
+}
+
+/*! Routes the points of set down the tree and adds them to the statistics of the leaves they reach, then retrains as subtrees 
+ *  the leaves that received at least minNPoints points of several labels, so that the cost only depends on the new points.
+ *  The tree is then pruned back to maxNLeaves, if not 0, as after training, so that repeated updates do not grow it.
+ *  The features of set must be those of the training set, as they are tested with the same indices. For each leaf of the 
+ *  updated tree, leafOrigins gets the index of the leaf it grew from, or was, before the update. */
+void ErcTree::update(const TrainingSet &set, const RandomInt *featureIndexGen, unsigned int minNPoints, double sMin, unsigned int tMax, unsigned int maxNLeaves, vector<unsigned int> &leafOrigins)
+{
+	traceScope("update");
+	if (_posteriors->nLabels == 0) _posteriors->nLabels = set.getNLabels();
+	vector<ErcTree *> oldLeaves(*_leaves);
+	vector<vector<unsigned int>> leafPoints(oldLeaves.size());
+	for (unsigned int i = 0; i < set.getNPoints(); ++i)
+	{
+		const ErcTree *leaf = set.isIntegral() ? test(set.getPointByteFeature(i)) : test(set.getPointFeature(i));
+		leafPoints[leaf->getLeafIndex()].push_back(i);
+	}
+
+	map<const ErcTree *, unsigned int> oldLeafIndices;
+	for (unsigned int l = 0; l < oldLeaves.size(); ++l)
+	{
+		ErcTree *leaf = oldLeaves[l];
+		oldLeafIndices[leaf] = l;
+		if (leafPoints[l].empty()) continue;
+
+		TrainingSet leafSet(set);
+		set.select(leafPoints[l], leafSet);
+		if (leaf->_isUnmixed && (!leafSet.isUnmixed() || leafSet.getPointLabel(0) != leaf->_unmixedLabel)) leaf->_setMixed();
+		leaf->_mergePosterior(leafSet);
+		if (leafSet.getNPoints() < minNPoints || leafSet.isUnmixed()) continue;
+
+		// Children only see the new points, while the leaf keeps the statistics of all of them if it is pruned back
+		unsigned int posteriorIndex = leaf->_posteriorIndex;
+		unsigned int nPoints = leaf->_nPoints;
+		leaf->_featureIndexGen = featureIndexGen;
+		leaf->train(leafSet, sMin, tMax);
+		leaf->_posteriorIndex = posteriorIndex;
+		leaf->_nPoints = nPoints;
+	}
+	computeGlobalProperties();
+
+	vector<ErcTree *> grownLeaves(*_leaves);
+	vector<unsigned int> grownOrigins(grownLeaves.size());
+	for (unsigned int l = 0; l < grownLeaves.size(); ++l)
+	{
+		const ErcTree *node = grownLeaves[l];
+		while (oldLeafIndices.find(node) == oldLeafIndices.end()) node = node->_parent;
+		grownOrigins[l] = oldLeafIndices[node];
+	}
+	if (maxNLeaves > 0) _prune(maxNLeaves);
+
+	// Pruned nodes keep their parent until the tree is compacted, so every grown leaf finds the leaf it was collapsed into, which takes the origin of its 
+	// grown leaf with the most points
+	map<const ErcTree *, unsigned int> leafIndices;
+	for (unsigned int l = 0; l < _leaves->size(); ++l) leafIndices[_leaves->at(l)] = l;
+	leafOrigins.assign(_leaves->size(), 0);
+	vector<int> originNPoints(_leaves->size(), -1);
+	for (unsigned int l = 0; l < grownLeaves.size(); ++l)
+	{
+		const ErcTree *node = grownLeaves[l];
+		while (leafIndices.find(node) == leafIndices.end()) node = node->_parent;
+		unsigned int leaf = leafIndices[node];
+		if ((int)grownLeaves[l]->_nPoints > originNPoints[leaf])
+		{
+			leafOrigins[leaf] = grownOrigins[l];
+			originNPoints[leaf] = grownLeaves[l]->_nPoints;
+		}
+	}
+	_compact();
+}
+
+unsigned int ErcTree::getNPoints(void) const
+{
+	return _nPoints;
+}
+
+/*! Training label distribution of the node, getNLabels() values summing to 1, or NULL if the tree was loaded without it. */
+const float *ErcTree::getPosterior(void) const
+{
+	return (_posteriorIndex == noNode) ? NULL : _posteriors->values.data() + _posteriorIndex;
+}
+
+unsigned int ErcTree::getNLabels(void) const
+{
+	return _posteriors->nLabels;
+}
+
 void ErcTree::computeGlobalProperties(bool fromRoot)
 {
 	if (isRoot())
@@ -220,27 +610,27 @@ void ErcTree::computeGlobalProperties(bool fromRoot)
 		return;
 	}
 
-	_leftChild->computeGlobalProperties();
-	_rightChild->computeGlobalProperties();
+	_getLeftChild()->computeGlobalProperties();
+	_getRightChild()->computeGlobalProperties();
 	if (isFinal())
 	{
 		_weakestFinalNode = this;
 	}
-	else if (_leftChild->isLeaf())
+	else if (_getLeftChild()->isLeaf())
 	{		
-		_weakestFinalNode = _rightChild->getWeakestFinalNode();
+		_weakestFinalNode = _getRightChild()->getWeakestFinalNode();
 	}
-	else if (_rightChild->isLeaf())
+	else if (_getRightChild()->isLeaf())
 	{		
-		_weakestFinalNode = _leftChild->getWeakestFinalNode();
+		_weakestFinalNode = _getLeftChild()->getWeakestFinalNode();
 	}
 	else 
 	{
-		double leftWeakestScore = _leftChild->getWeakestFinalNode()->getScore();
-		double rightWeakestScore = _rightChild->getWeakestFinalNode()->getScore();
-		_weakestFinalNode = (leftWeakestScore < rightWeakestScore) ? _leftChild->getWeakestFinalNode() : _rightChild->getWeakestFinalNode();	
+		double leftWeakestScore = _getLeftChild()->getWeakestFinalNode()->getScore();
+		double rightWeakestScore = _getRightChild()->getWeakestFinalNode()->getScore();
+		_weakestFinalNode = (leftWeakestScore < rightWeakestScore) ? _getLeftChild()->getWeakestFinalNode() : _getRightChild()->getWeakestFinalNode();	
 	}
-	_nLeaves = _rightChild->getNLeaves() + _leftChild->getNLeaves();
+	_nLeaves = _getRightChild()->getNLeaves() + _getLeftChild()->getNLeaves();
 }
 
 bool ErcTree::isLeaf(void) const 
@@ -250,8 +640,8 @@ bool ErcTree::isLeaf(void) const
 
 bool ErcTree::isFinal(void) const 
 {
-	if (_leftChild == NULL || _rightChild == NULL) return false;
-	return _leftChild->isLeaf() && _rightChild->isLeaf();
+	if (_leftChildIndex == noNode || _rightChildIndex == noNode) return false;
+	return _getLeftChild()->isLeaf() && _getRightChild()->isLeaf();
 }
 
 bool ErcTree::isRoot(void) const 
@@ -269,9 +659,19 @@ unsigned int ErcTree::getNLeaves(void) const
 	return _nLeaves;
 }
 
+/*! Collapses the weakest final nodes until the tree has at most maxNLeaves leaves, then compacts it so that the collapsed 
+ *  subtrees release their memory. */
 void ErcTree::prune(unsigned int maxNLeaves)
 {
+	traceScope("prune");
 	if (_nLeaves <= maxNLeaves) return;
+	_prune(maxNLeaves);
+	_compact();
+}
+
+/*! Unlinks the collapsed subtrees only, which stay in the arena with their parent until _compact. */
+void ErcTree::_prune(unsigned int maxNLeaves)
+{
 	while (_nLeaves > maxNLeaves)
 	{
 		ErcTree *parent = _weakestFinalNode->getParent();
@@ -279,16 +679,56 @@ void ErcTree::prune(unsigned int maxNLeaves)
 	}
 }
 
+/*! Copies the nodes still reachable from the root, with their label distributions, into a new arena in preorder and frees the 
+ *  old one, so that a pruned or updated tree only holds its own nodes. Pointers to the previous nodes become invalid. */
+void ErcTree::_compact(void)
+{
+	Arena<ErcTree> *arena = _arena;
+	vector<float> values;
+	_copySubtree(new Arena<ErcTree>(), values);
+	delete arena;
+	_posteriors->values.swap(values);
+	computeGlobalProperties();
+}
+
+/*! Copies the children of this node, itself already copied, into arena and the label distribution of the node into values, 
+ *  then recurses into the copies, which still read their own children from the previous arena. */
+void ErcTree::_copySubtree(Arena<ErcTree> *arena, vector<float> &values)
+{
+	if (_posteriorIndex != noNode)
+	{
+		unsigned int posteriorIndex = values.size();
+		values.insert(values.end(), _posteriors->values.begin() + _posteriorIndex, _posteriors->values.begin() + _posteriorIndex + _posteriors->nLabels);
+		_posteriorIndex = posteriorIndex;
+	}
+	if (!_isLeaf)
+	{
+		ErcTree *left = _getLeftChild();
+		ErcTree *right = _getRightChild();
+		_leftChildIndex = arena->allocate();
+		*new ((*arena)[_leftChildIndex]) ErcTree(*this, true) = *left;
+		_rightChildIndex = arena->allocate();
+		*new ((*arena)[_rightChildIndex]) ErcTree(*this, true) = *right;
+		ErcTree *children[2] = { (*arena)[_leftChildIndex], (*arena)[_rightChildIndex] };
+		for (unsigned int c = 0; c < 2; ++c)
+		{
+			children[c]->_parent = this;
+			children[c]->_copySubtree(arena, values);
+		}
+	}
+	_arena = arena;
+}
+
 void ErcTree::removeChild(ErcTree *child)
 {
-	if (child == _leftChild)
+	if (child == _getLeftChild())
 	{
-		_leftChild->leaf();
+		_getLeftChild()->leaf();
 		computeGlobalProperties(true);
 	}
-	else if (child == _rightChild)
+	else if (child == _getRightChild())
 	{
-		_rightChild->leaf();
+		_getRightChild()->leaf();
 		computeGlobalProperties(true);
 	}
 }
@@ -308,11 +748,24 @@ unsigned int ErcTree::getLeafIndex(void) const
 	return _leafIndex;
 }
 
-const ErcTree *ErcTree::test(const CImg<double> &feature) const
+unsigned int ErcTree::getTestFeatureIndex(void) const 
+{
+	return _testFeatureIndex;
+}
+
+double ErcTree::getTestThreshold(void) const 
+{
+	return _testThreshold;
+}
+
+const ErcTree *ErcTree::getLeftChild(void) const 
+{
+	return _getLeftChild();
+}
+
+const ErcTree *ErcTree::getRightChild(void) const 
 {
-	if (isLeaf()) return this;
-	if (feature.atX(_testFeatureIndex) < _testThreshold) return _leftChild->test(feature);
-	return _rightChild->test(feature);
+	return _getRightChild();
 }
 
 string ErcTree::xml(void) const 
@@ -323,13 +776,44 @@ string ErcTree::xml(void) const
 	{
 		output << "<leaf index=\"" << _leafIndex << "\" unmixed=\"" << isUnmixed() << "\"";
 		if (isUnmixed()) output << " label=\"" << getUnmixedLabel() << "\"";
+		if (_nPoints > 0) output << " points=\"" << _nPoints << "\"";
+		if (getPosterior() != NULL)
+		{
+			output << " posterior=\"";
+			for (unsigned int l = 0; l < getNLabels(); ++l) output << ((l > 0) ? " " : "") << getPosterior()[l];
+			output << "\"";
+		}
 		output << "/>";
 	}
 	else 
 	{
 		output << "<node score=\"" << _score << "\" testIndex=\"" << _testFeatureIndex << "\" testThreshold=\"" << _testThreshold << "\">";
-		output << _leftChild->xml() << _rightChild->xml() << "</node>";
+		output << _getLeftChild()->xml() << _getRightChild()->xml() << "</node>";
+	}
+	return output.str();
+}
+
+/*! C++ statements returning the leaf index reached from this node, as a flat chain of tests where the left child 
+ *  follows its parent and right children are jumped to. Nodes are numbered in preorder from nodeIndex, which is advanced past the subtree.
+ *  A flat chain keeps deep trees within the compiler's block nesting limit. */
+string ErcTree::cpp(unsigned int &nodeIndex, bool isLabeled) const 
+{
+	stringstream output;
+	output << setprecision(17);
+	if (isLabeled) output << "n" << nodeIndex << ":";
+	++nodeIndex;
+
+	if (isLeaf())
+	{
+		output << "\treturn " << _leafIndex << ";\n";
+		return output.str();
 	}
+
+	string left = _getLeftChild()->cpp(nodeIndex);
+	unsigned int rightIndex = nodeIndex;
+	string right = _getRightChild()->cpp(nodeIndex, true);
+	output << "\tif (!(f[" << _testFeatureIndex << "] < " << _testThreshold << ")) goto n" << rightIndex << ";\n";
+	output << left << right;
 	return output.str();
 }
 
@@ -10,16 +10,25 @@ namespace ercf
 	class ErcTree
 	{
 	public:
+		/*! Number of (feature, threshold) candidates scored per pass over a node's points. */
+		static const unsigned int splitBatchSize = 8;
+
 		ErcTree(void);
 		ErcTree(const ErcTree &tree);
 		ErcTree(const TiXmlElement *xmlElement, ErcTree *parent = NULL);
+		ErcTree(istream &input, ErcTree *parent);
 		ErcTree(ErcTree &tree, bool asChild);
 		ErcTree(const RandomInt *featureIndexGen,  ErcTree *parent = NULL);
 		~ErcTree(void);
 		void assign(const RandomInt *featureIndexGen,  ErcTree *parent = NULL);
 		void assign(const TiXmlElement *xmlElement, ErcTree *parent = NULL);
+		void read(istream &input, ErcTree *parent = NULL);
+		void write(ostream &output) const;
 		void leaf(void);
 		void train(TrainingSet &set, double sMin, unsigned int tMax);
+		void update(const TrainingSet &set, const RandomInt *featureIndexGen, unsigned int minNPoints, double sMin, unsigned int tMax, unsigned int maxNLeaves, vector<unsigned int> &leafOrigins);
+		void setApproximateSplits(unsigned int minNPoints);
+		void setSplitSubsample(unsigned int maxNPoints, double fraction = 1.);
 		void prune(unsigned int maxNLeaves);
 		ErcTree *getWeakestFinalNode(void);
 		double getScore(void) const;
@@ -30,23 +39,53 @@ namespace ercf
 		void removeChild(ErcTree *child);		
 		ErcTree *getParent(void);
 		unsigned int getIndex(void) const;
-		const ErcTree *test(const CImg<double> &feature) const;
+		template<typename T> const ErcTree *test(const CImg<T> &feature) const;
 		static double getPartitionScore(double entropy1, double entropy2, double jointEntropy);
+		static double getPartitionScore(double labelEntropy, const unsigned int *labelSetOccurences, unsigned int nLabels);
 		string xml(void) const;
+		string cpp(unsigned int &nodeIndex, bool isLabeled = false) const;
 		bool isUnmixed(void) const;
 		unsigned int getUnmixedLabel(void) const;
 		void computeGlobalProperties(bool fromRoot = false);
 		vector<ErcTree *> *getLeaves(void) const;
 		unsigned int getLeafIndex(void) const;
+		unsigned int getTestFeatureIndex(void) const;
+		double getTestThreshold(void) const;
+		const ErcTree *getLeftChild(void) const;
+		const ErcTree *getRightChild(void) const;
+		const float *getPosterior(void) const;
+		unsigned int getNLabels(void) const;
+		unsigned int getNPoints(void) const;
 		bool verbose;
 
 
 	private:		
+		static const unsigned int noNode = 0xFFFFFFFF;
+
+		/*! Label distributions of all the nodes of a tree, nLabels values per node. */
+		struct Posteriors
+		{
+			unsigned int nLabels;
+			vector<float> values;
+		};
+
+		void _initRoot(void);
+		ErcTree *_getLeftChild(void) const;
+		ErcTree *_getRightChild(void) const;
+		unsigned int _getSubsampleSize(unsigned int nPoints) const;
+		unsigned int _trainBatchedSplit(TrainingSet &set, double entropy, double sMin, unsigned int tMax);
+		unsigned int _trainHistogramSplit(TrainingSet &set, double entropy, double sMin, unsigned int tMax);
+		void _recordPosterior(const TrainingSet &set);
+		void _mergePosterior(const TrainingSet &set);
+		void _setMixed(void);
+		void _prune(unsigned int maxNLeaves);
+		void _compact(void);
+		void _copySubtree(Arena<ErcTree> *arena, vector<float> &values);
 		bool _isLeaf;
 		unsigned int _testFeatureIndex;
 		double _testThreshold;
-		ErcTree *_leftChild;
-		ErcTree *_rightChild;
+		unsigned int _leftChildIndex;
+		unsigned int _rightChildIndex;
 		ErcTree *_parent;
 		ErcTree *_weakestFinalNode;
 		const RandomInt *_featureIndexGen;
@@ -55,8 +94,27 @@ namespace ercf
 		bool _isUnmixed;
 		unsigned int _unmixedLabel;
 		vector<ErcTree *> *_leaves;
+		Arena<ErcTree> *_arena;
+		Posteriors *_posteriors;
+		unsigned int _posteriorIndex;
+		/*! Number of training points that reached the node, 0 if unknown. */
+		unsigned int _nPoints;
 		unsigned int _leafIndex;
+		unsigned int _approxMinNPoints;
+		unsigned int _subsampleMaxNPoints;
+		double _subsampleFraction;
 	};
 
-}
+	/*! Leaf reached by a descriptor, stored as doubles or, for byte descriptors such as SIFT, as unsigned chars. */
+	template<typename T>
+	const ErcTree *ErcTree::test(const CImg<T> &feature) const
+	{
+		const ErcTree *node = this;
+		while (!node->isLeaf())
+		{
+			node = (*_arena)[(feature[node->_testFeatureIndex] < node->_testThreshold) ? node->_leftChildIndex : node->_rightChildIndex];
+		}
+		return node;
+	}
 
+}
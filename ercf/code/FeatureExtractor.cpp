@@ -4,36 +4,24 @@
 
 using namespace ercf;
 
-FeatureExtractor::FeatureExtractor(CImgList<double> *featureList, unsigned int *nDescriptorsPerImage, unsigned int maxNfeatures, CImgList<double> *images, CImgList<bool> *masks) 
-	: _images(images), _featureList(featureList), _maxNFeatures(maxNfeatures), _masks(masks), _positions(NULL), _labels(NULL), _display(false),  _nDescriptorsPerImage(nDescriptorsPerImage)
+FeatureExtractor::FeatureExtractor(CImgList<double> *featureList, unsigned int *nDescriptorsPerImage, unsigned int maxNfeatures, CImgList<float> *images, vector<BitMask> *masks) 
+	: _images(images), _featureList(featureList), _siftList(NULL), _maxNFeatures(maxNfeatures), _masks(masks), _positions(NULL), _labels(NULL), _display(false),  _nDescriptorsPerImage(nDescriptorsPerImage), _random(NULL)
 {
-	_init();	
 }
 
-FeatureExtractor::FeatureExtractor(CImgList<double> *featureList, unsigned int *nDescriptorsPerImage, vector<unsigned int> *labels, unsigned int maxNfeatures, CImgList<double> *images, CImgList<bool> *masks)
-	: _images(images), _featureList(featureList), _maxNFeatures(maxNfeatures), _masks(masks), _positions(NULL), _labels(labels), _display(false),  _nDescriptorsPerImage(nDescriptorsPerImage)
+FeatureExtractor::FeatureExtractor(CImgList<double> *featureList, unsigned int *nDescriptorsPerImage, vector<unsigned int> *labels, unsigned int maxNfeatures, CImgList<float> *images, vector<BitMask> *masks)
+	: _images(images), _featureList(featureList), _siftList(NULL), _maxNFeatures(maxNfeatures), _masks(masks), _positions(NULL), _labels(labels), _display(false),  _nDescriptorsPerImage(nDescriptorsPerImage), _random(NULL)
 {
-	_init();
 }
 
-FeatureExtractor::FeatureExtractor(CImgList<double> *featureList, unsigned int *nDescriptorsPerImage, vector<unsigned int> *labels, CImg<double> *positions, unsigned int maxNfeatures, CImgList<double> *images, CImgList<bool> *masks)
-	: _images(images), _featureList(featureList), _maxNFeatures(maxNfeatures), _masks(masks), _positions(positions), _labels(labels), _display(false),  _nDescriptorsPerImage(nDescriptorsPerImage)
+FeatureExtractor::FeatureExtractor(CImgList<double> *featureList, unsigned int *nDescriptorsPerImage, vector<unsigned int> *labels, CImg<double> *positions, unsigned int maxNfeatures, CImgList<float> *images, vector<BitMask> *masks)
+	: _images(images), _featureList(featureList), _siftList(NULL), _maxNFeatures(maxNfeatures), _masks(masks), _positions(positions), _labels(labels), _display(false),  _nDescriptorsPerImage(nDescriptorsPerImage), _random(NULL)
 {
-	_init();
 }
 
-FeatureExtractor::FeatureExtractor(CImgList<double> *featureList, unsigned int *nDescriptorsPerImage, CImg<double> *positions, unsigned int maxNfeatures, CImgList<double> *images, CImgList<bool> *masks)
-	: _images(images), _featureList(featureList), _maxNFeatures(maxNfeatures), _masks(masks), _positions(positions), _labels(NULL), _display(false),  _nDescriptorsPerImage(nDescriptorsPerImage)
+FeatureExtractor::FeatureExtractor(CImgList<double> *featureList, unsigned int *nDescriptorsPerImage, CImg<double> *positions, unsigned int maxNfeatures, CImgList<float> *images, vector<BitMask> *masks)
+	: _images(images), _featureList(featureList), _siftList(NULL), _maxNFeatures(maxNfeatures), _masks(masks), _positions(positions), _labels(NULL), _display(false),  _nDescriptorsPerImage(nDescriptorsPerImage), _random(NULL)
 {
-	_init();
-}
-
-void FeatureExtractor::_init(void)
-{
-	if (_masks != NULL) 
-	{
-		_sortedMaskPositions.assign(_images->size(), AssociativeSortedList<unsigned int, unsigned int>());
-	}
 }
 
 bool FeatureExtractor::useMasks(void) const
@@ -56,38 +44,40 @@ void FeatureExtractor::setDisplay(bool display)
 	_display = display;
 }
 
-void FeatureExtractor::_computeMaskIndices(unsigned int imageIndex)
+/*! Stores SIFT descriptors as bytes in siftList, at the same indices as they would have in the feature list. Only training uses it: 
+ *  inference describes images as doubles holding the same byte values, so the forest reaches the same leaves either way. */
+void FeatureExtractor::setSiftList(CImgList<unsigned char> *siftList)
 {
-	if (!_sortedMaskPositions.isNull(imageIndex)) return;
-	_sortedMaskPositions.set(imageIndex);
-	_sortedMaskPositions[imageIndex].assign(_masks->at(imageIndex).sum());
-	unsigned int w = _images->at(imageIndex).width();
-	unsigned int h = _images->at(imageIndex).height();
-	for (unsigned int x = 0; x < w; ++x)
-		for (unsigned int y = 0; y <h; ++y)
-		{
-			if (_masks->operator()(imageIndex, x, y))
-			{			
-				unsigned int dist = min(w - x, h - y);
-				_sortedMaskPositions[imageIndex].insert(dist, packXY(x, y, w));
-			}
-		}
+	_siftList = siftList;
+}
+
+/*! Draws patch positions, scales and SIFT subsamples from random instead of the default generator of the thread, NULL to restore it. */
+void FeatureExtractor::setRandom(const RandomDouble *random)
+{
+	_random = random;
+}
+
+double FeatureExtractor::_getRandom(void) const
+{
+	return (_random != NULL) ? (*_random)() : RandomDouble::Default();
 }
 
 bool FeatureExtractor::getRandomPoint(unsigned int &x, unsigned int &y, unsigned int imageIndex, unsigned int patchSize)
 {
-	double r = RandomDouble::Default();
+	double r = _getRandom();
 
 	if (useMasks())
 	{		
-		_computeMaskIndices(imageIndex);
-		if (_sortedMaskPositions[imageIndex].getMaxKey() < patchSize) return false;
-
-		unsigned int firstIndex = _sortedMaskPositions[imageIndex].lowerBound(patchSize);
-		unsigned int n = firstIndex + round(r * (_sortedMaskPositions[imageIndex].size() - firstIndex - 1));
-		unsigned int xy = _sortedMaskPositions[imageIndex][n];
-		x = unpackX(xy, _images->at(imageIndex).width());
-		y = unpackY(xy, _images->at(imageIndex).width());
+		const BitMask &mask = _masks->at(imageIndex);
+		if (patchSize > mask.width() || patchSize > mask.height()) return false;
+
+		unsigned int maxX = mask.width() - patchSize;
+		unsigned int maxY = mask.height() - patchSize;
+		unsigned int nPoints = mask.countWithin(maxX, maxY);
+		if (nPoints == 0) return false;
+
+		unsigned int n = round(r * (nPoints - 1));
+		mask.select(n, maxX, maxY, x, y);
 	}
 	else
 	{
@@ -104,6 +94,7 @@ bool FeatureExtractor::getRandomPoint(unsigned int &x, unsigned int &y, unsigned
 
 unsigned int FeatureExtractor::getHsl(unsigned int featureStartIndex, unsigned int imageIndex, unsigned int patchSize, unsigned int label)
 {
+	traceScope("extract");
 	unsigned int x, y;	
 	x = y = 0;
 	Plot plot;
@@ -111,7 +102,7 @@ unsigned int FeatureExtractor::getHsl(unsigned int featureStartIndex, unsigned i
 
 	for (unsigned int i = 0; i < _maxNFeatures; ++i)
 	{
-		double r = RandomDouble::Default();
+		double r = _getRandom();
 		double scale = 0.5 + 0.5 * r;
 		unsigned int scaledPatchSize = (unsigned int)(patchSize / scale);
 		getRandomPoint(x, y, imageIndex, scaledPatchSize);
@@ -136,6 +127,7 @@ unsigned int FeatureExtractor::getHsl(unsigned int featureStartIndex, unsigned i
 
 unsigned int FeatureExtractor::getHslHaar(unsigned int featureStartIndex, unsigned int imageIndex, unsigned int patchSize, unsigned int label)
 {
+	traceScope("extract");
 	unsigned int x, y;	
 	x = y = 0;
 	Plot plot;
@@ -143,7 +135,7 @@ unsigned int FeatureExtractor::getHslHaar(unsigned int featureStartIndex, unsign
 
 	for (unsigned int i = 0; i < _maxNFeatures; ++i)
 	{
-		double r = RandomDouble::Default();
+		double r = _getRandom();
 		double scale = 0.25 + 0.75 * r;
 		unsigned int scaledPatchSize = (unsigned int)(patchSize / scale);
 		getRandomPoint(x, y, imageIndex, scaledPatchSize);
@@ -170,10 +162,10 @@ unsigned int FeatureExtractor::getHslHaar(unsigned int featureStartIndex, unsign
 
 unsigned int FeatureExtractor::getSift(unsigned int featureStartIndex, unsigned int imageIndex, unsigned int label)
 {
-
+	traceScope("extract");
 	CImg<float> im(_images->at(imageIndex).get_channel(2));
-	if (useMasks() && !usePositions()) im.mul(_masks->at(imageIndex)).autocrop(0.F);
-	else if (useMasks()) im.mul(_masks->at(imageIndex));
+	if (useMasks()) _masks->at(imageIndex).apply(im);
+	if (useMasks() && !usePositions()) im.autocrop(0.F);
 
 	Plot plot;
 	if (_display) plot.assign(CImg<double>(im));
@@ -181,7 +173,8 @@ unsigned int FeatureExtractor::getSift(unsigned int featureStartIndex, unsigned
 	VlSiftFilt *siftDetector = vl_sift_new(im.width(), im.height(), -1, 3, 0);
 	vector<VlSiftKeypoint> points;
 	vector<double> orientations;
-	vector<array<vl_sift_pix, 128>> descriptors;
+	vector<array<unsigned char, 128>> descriptors;
+	vl_sift_pix descriptor[128];
 
 	unsigned int count = 0;
 		
@@ -198,8 +191,13 @@ unsigned int FeatureExtractor::getSift(unsigned int featureStartIndex, unsigned
 			{
 				points.push_back(keypoints[k]);
 				orientations.push_back(angles[o]);
-				descriptors.push_back(array<vl_sift_pix, 128>());
-				vl_sift_calc_keypoint_descriptor(siftDetector, descriptors.back().data(), keypoints + k, angles[o]);
+				vl_sift_calc_keypoint_descriptor(siftDetector, descriptor, keypoints + k, angles[o]);
+				// Components are at most 0.5 once normalized, so they are quantized to bytes as VLFeat does
+				descriptors.push_back(array<unsigned char, 128>());
+				for (unsigned int d = 0; d < 128; ++d)
+				{
+					descriptors.back()[d] = (unsigned char)min(512.F * descriptor[d], 255.F);
+				}
 			}
 		}
 	}
@@ -207,7 +205,7 @@ unsigned int FeatureExtractor::getSift(unsigned int featureStartIndex, unsigned
 
 	while (points.size() > _maxNFeatures)
 	{
-		unsigned int index = round((points.size() - 1) * RandomDouble::Default());
+		unsigned int index = round((points.size() - 1) * _getRandom());
 		points.erase(points.begin() + index);
 		orientations.erase(orientations.begin() + index);
 		descriptors.erase(descriptors.begin() + index);
@@ -216,7 +214,8 @@ unsigned int FeatureExtractor::getSift(unsigned int featureStartIndex, unsigned
 	for (unsigned int i = 0; i < points.size(); ++i)
 	{		
 		if (_display) plot(round(points[i].x), round(points[i].y));	
-		_featureList->at(featureStartIndex + i).assign(CImg<vl_sift_pix>(descriptors[i].data(), 1, 128));
+		if (_siftList != NULL) _siftList->at(featureStartIndex + i).assign(descriptors[i].data(), 1, 128);
+		else _featureList->at(featureStartIndex + i).assign(CImg<unsigned char>(descriptors[i].data(), 1, 128));
 
 		if (useLabels()) _labels->at(featureStartIndex + i) = label;
 		if (usePositions())
@@ -233,6 +232,184 @@ unsigned int FeatureExtractor::getSift(unsigned int featureStartIndex, unsigned
 	return points.size();
 }
 
+/*! Feature types: 0 for HSL patches, 1 for Haar transforms of HSL patches, anything else for SIFT. */
+unsigned int FeatureExtractor::getFeatures(unsigned int featureType, unsigned int featureStartIndex, unsigned int imageIndex, unsigned int patchSize, unsigned int label)
+{
+	if (featureType == 0) return getHsl(featureStartIndex, imageIndex, patchSize, label);
+	if (featureType == 1) return getHslHaar(featureStartIndex, imageIndex, patchSize, label);
+	return getSift(featureStartIndex, imageIndex, label);
+}
+
+/*! Extracts the descriptors of a single image as the columns of a feature matrix, with their positions, sampled from random if not NULL. */
+unsigned int FeatureExtractor::describe(CImgList<float> &images, unsigned int imageIndex, unsigned int featureType, unsigned int maxNFeatures, unsigned int patchSize, CImg<double> &features, CImg<double> &positions, const RandomDouble *random)
+{
+	vector<unsigned int> nDescriptorsPerImage(images.size());
+	CImgList<double> featureList(maxNFeatures);
+	positions.assign(maxNFeatures, 2);
+	FeatureExtractor featureExtractor(&featureList, nDescriptorsPerImage.data(), &positions, maxNFeatures, &images);
+	featureExtractor.setRandom(random);
+
+	unsigned int nDescriptors = featureExtractor.getFeatures(featureType, 0, imageIndex, patchSize);
+
+	while (featureList.size() > nDescriptors) featureList.pop_back();
+	features = featureList.get_append('x');
+	return nDescriptors;
+}
+
+DescriptorStream::DescriptorStream(CImgList<float> &images, unsigned int imageIndex, unsigned int featureType, unsigned int maxNFeatures, unsigned int patchSize)
+	: _images(images), _imageIndex(imageIndex), _featureType(featureType), _maxNFeatures(maxNFeatures), _patchSize(patchSize), _nExtracted(0)
+{
+	if (_featureType < 2) return;
+	CImg<double> positions;
+	unsigned int nFeatures = FeatureExtractor::describe(_images, _imageIndex, _featureType, _maxNFeatures, _patchSize, _siftFeatures, positions);
+	_maxNFeatures = nFeatures;
+	for (unsigned int i = nFeatures; i > 1; --i)
+	{
+		unsigned int j = min((unsigned int)(i * RandomDouble::Default()), i - 1);
+		if (j == i - 1) continue;
+		for (unsigned int d = 0; d < _siftFeatures.height(); ++d)
+		{
+			swap(_siftFeatures(i - 1, d), _siftFeatures(j, d));
+		}
+	}
+}
+
+/*! Extracts up to batchSize more descriptors as the columns of features and returns how many, 0 once maxNFeatures were handed out. */
+unsigned int DescriptorStream::next(unsigned int batchSize, CImg<double> &features)
+{
+	unsigned int n = min(batchSize, _maxNFeatures - _nExtracted);
+	if (n == 0) return 0;
+	if (_featureType < 2)
+	{
+		CImg<double> positions;
+		n = FeatureExtractor::describe(_images, _imageIndex, _featureType, n, _patchSize, features, positions);
+	}
+	else features = _siftFeatures.get_columns(_nExtracted, _nExtracted + n - 1);
+	_nExtracted += n;
+	return n;
+}
+
+unsigned int DescriptorStream::getNExtracted(void) const
+{
+	return _nExtracted;
+}
+
+TiledExtractor::TiledExtractor(unsigned int featureType, unsigned int patchSize, unsigned int tileSize, unsigned int overlap, int seed)
+	: _featureType(featureType), _patchSize(patchSize), _tileSize(max(tileSize, 4 * patchSize)), _overlap(min(overlap, _tileSize / 2)), _seed(seed)
+{
+}
+
+/*! Reads the size of the first image of an uncompressed .cimg file, which CImg can load a crop of without reading the rest. */
+bool TiledExtractor::_getCimgSize(const string &imagePath, unsigned int &width, unsigned int &height)
+{
+	if (imagePath.size() < 5 || imagePath.compare(imagePath.size() - 5, 5, ".cimg") != 0) return false;
+	FILE *file = fopen(imagePath.c_str(), "rb");
+	if (file == NULL) return false;
+
+	char line[256];
+	unsigned int nImages, depth, spectrum;
+	bool isUncompressed = fgets(line, 256, file) != NULL && sscanf(line, "%u", &nImages) == 1 && nImages > 0
+		&& fgets(line, 256, file) != NULL && sscanf(line, "%u %u %u %u", &width, &height, &depth, &spectrum) == 4 && strchr(line, '#') == NULL;
+	fclose(file);
+	return isUncompressed;
+}
+
+/*! Bounds of tile index along an axis of size pixels, and of its core, where the cores of consecutive tiles meet in the middle of their overlap. */
+void TiledExtractor::_getTile(unsigned int index, unsigned int nTiles, unsigned int size, unsigned int &first, unsigned int &last, unsigned int &coreFirst, unsigned int &coreLast) const
+{
+	unsigned int step = _tileSize - _overlap;
+	first = index * step;
+	last = min(first + _tileSize, size) - 1;
+	coreFirst = index == 0 ? 0 : first + _overlap / 2;
+	coreLast = index == nTiles - 1 ? size - 1 : first + step + _overlap / 2 - 1;
+}
+
+/*! Extracts about maxNFeatures descriptors of the image at imagePath as the columns of features, with their positions and the size of the image. */
+unsigned int TiledExtractor::describe(const string &imagePath, unsigned int maxNFeatures, CImg<double> &features, CImg<double> &positions, unsigned int &width, unsigned int &height) const
+{
+	traceScope("describeTiled");
+	CImg<unsigned char> rgb;
+	bool isStreamed = _getCimgSize(imagePath, width, height);
+	if (!isStreamed)
+	{
+		traceScope("decode");
+		rgb.load(imagePath.c_str());
+		width = rgb.width();
+		height = rgb.height();
+	}
+
+	unsigned int step = _tileSize - _overlap;
+	unsigned int nTilesX = width <= _tileSize ? 1 : (width - _tileSize + step - 1) / step + 1;
+	unsigned int nTilesY = height <= _tileSize ? 1 : (height - _tileSize + step - 1) / step + 1;
+	vector<CImg<double>> tileFeatures(nTilesX * nTilesY);
+	vector<CImg<double>> tilePositions(nTilesX * nTilesY);
+
+	#pragma omp parallel for schedule(dynamic)
+	for (int t = 0; t < (int)tileFeatures.size(); ++t)
+	{
+		traceScope("tile");
+		unsigned int x0, x1, coreX0, coreX1, y0, y1, coreY0, coreY1;
+		_getTile(t % nTilesX, nTilesX, width, x0, x1, coreX0, coreX1);
+		_getTile(t / nTilesX, nTilesY, height, y0, y1, coreY0, coreY1);
+
+		CImg<unsigned char> tileRgb;
+		if (isStreamed) tileRgb.load_cimg(imagePath.c_str(), 0, 0, x0, y0, 0, 0, x1, y1, 0, 2);
+		else tileRgb = rgb.get_crop(x0, y0, x1, y1);
+		if (tileRgb.width() < _patchSize * 4 || tileRgb.height() < _patchSize * 4) continue;
+
+		CImgList<float> tileImages(1);
+		rgbToHslImage(tileRgb, tileImages[0]);
+		tileRgb.assign();
+
+		// Sampling in proportion to the tile area keeps about maxNFeatures over the cores, which partition the image
+		unsigned int nTileFeatures = max((unsigned int)ceil((double)maxNFeatures * tileImages[0].width() * tileImages[0].height() / ((double)width * height)), 1U);
+		CImg<double> f, p;
+		RandomDouble random(0., 1., (double)(_seed + t));
+		unsigned int n = FeatureExtractor::describe(tileImages, 0, _featureType, nTileFeatures, _patchSize, f, p, &random);
+
+		vector<unsigned int> kept;
+		for (unsigned int i = 0; i < n; ++i)
+		{
+			unsigned int x = x0 + (unsigned int)p(i, 0);
+			unsigned int y = y0 + (unsigned int)p(i, 1);
+			if (x >= coreX0 && x <= coreX1 && y >= coreY0 && y <= coreY1) kept.push_back(i);
+		}
+		if (kept.empty()) continue;
+
+		tileFeatures[t].assign(kept.size(), f.height());
+		tilePositions[t].assign(kept.size(), 2);
+		for (unsigned int k = 0; k < kept.size(); ++k)
+		{
+			cimg_forY(f, d) tileFeatures[t](k, d) = f(kept[k], d);
+			tilePositions[t](k, 0) = x0 + p(kept[k], 0);
+			tilePositions[t](k, 1) = y0 + p(kept[k], 1);
+		}
+	}
+
+	// Tiles are appended in raster order, so that the result does not depend on the scheduling
+	unsigned int nFeatures = 0;
+	unsigned int featureDim = 0;
+	for (unsigned int t = 0; t < tileFeatures.size(); ++t)
+	{
+		nFeatures += tileFeatures[t].width();
+		featureDim = max(featureDim, (unsigned int)tileFeatures[t].height());
+	}
+	features.assign(nFeatures, featureDim);
+	positions.assign(nFeatures, 2);
+	unsigned int i = 0;
+	for (unsigned int t = 0; t < tileFeatures.size(); ++t)
+	{
+		for (unsigned int k = 0; k < tileFeatures[t].width(); ++k, ++i)
+		{
+			cimg_forY(features, d) features(i, d) = tileFeatures[t](k, d);
+			positions(i, 0) = tilePositions[t](k, 0);
+			positions(i, 1) = tilePositions[t](k, 1);
+		}
+	}
+	Trace::counter("tiles", tileFeatures.size());
+	return nFeatures;
+}
+
 unsigned int FeatureExtractor::getMultipleHsl(unsigned int featureStartIndex, unsigned int imageFirstIndex, unsigned int nImages, unsigned int patchSize, unsigned int label)
 {
 	unsigned int nFeatures = 0;
@@ -7,13 +7,14 @@ namespace ercf
 	class FeatureExtractor
 	{
 	public:
-		FeatureExtractor(CImgList<double> *featureList, unsigned int *nDescriptorsPerImage, unsigned int maxNfeatures, CImgList<double> *images, CImgList<bool> *masks = NULL);
-		FeatureExtractor(CImgList<double> *featureList, unsigned int *nDescriptorsPerImage, vector<unsigned int> *labels, unsigned int maxNfeatures, CImgList<double> *images, CImgList<bool> *masks = NULL);
-		FeatureExtractor(CImgList<double> *featureList, unsigned int *nDescriptorsPerImage, vector<unsigned int> *labels, CImg<double> *positions, unsigned int maxNfeatures, CImgList<double> *images, CImgList<bool> *masks = NULL);
-		FeatureExtractor(CImgList<double> *featureList, unsigned int *nDescriptorsPerImage, CImg<double> *positions, unsigned int maxNfeatures, CImgList<double> *images, CImgList<bool> *masks = NULL);
+		FeatureExtractor(CImgList<double> *featureList, unsigned int *nDescriptorsPerImage, unsigned int maxNfeatures, CImgList<float> *images, vector<BitMask> *masks = NULL);
+		FeatureExtractor(CImgList<double> *featureList, unsigned int *nDescriptorsPerImage, vector<unsigned int> *labels, unsigned int maxNfeatures, CImgList<float> *images, vector<BitMask> *masks = NULL);
+		FeatureExtractor(CImgList<double> *featureList, unsigned int *nDescriptorsPerImage, vector<unsigned int> *labels, CImg<double> *positions, unsigned int maxNfeatures, CImgList<float> *images, vector<BitMask> *masks = NULL);
+		FeatureExtractor(CImgList<double> *featureList, unsigned int *nDescriptorsPerImage, CImg<double> *positions, unsigned int maxNfeatures, CImgList<float> *images, vector<BitMask> *masks = NULL);
 		unsigned int getHsl(unsigned int featureStartIndex, unsigned int imageIndex, unsigned int patchSize, unsigned int label = 0);
 		unsigned int getHslHaar(unsigned int featureStartIndex, unsigned int imageIndex, unsigned int patchSize, unsigned int label = 0);
 		unsigned int getSift(unsigned int featureStartIndex, unsigned int imageIndex, unsigned int label = 0);
+		unsigned int getFeatures(unsigned int featureType, unsigned int featureStartIndex, unsigned int imageIndex, unsigned int patchSize, unsigned int label = 0);
 		unsigned int getMultipleHsl(unsigned int featureStartIndex, unsigned int imageFirstIndex, unsigned int nImages, unsigned int patchSize, unsigned int label = 0);
 		unsigned int getMultipleHslHaar(unsigned int featureStartIndex, unsigned int imageFirstIndex, unsigned int nImages, unsigned int patchSize, unsigned int label = 0);
 		unsigned int getMultipleSift(unsigned int featureStartIndex, unsigned int imageFirstIndex, unsigned int nImages, unsigned int label = 0);	
@@ -22,18 +23,63 @@ namespace ercf
 		bool usePositions(void) const;
 		bool useLabels(void) const;
 		void setDisplay(bool display);
+		void setSiftList(CImgList<unsigned char> *siftList);
+		void setRandom(const RandomDouble *random);
+		static unsigned int describe(CImgList<float> &images, unsigned int imageIndex, unsigned int featureType, unsigned int maxNFeatures, unsigned int patchSize, CImg<double> &features, CImg<double> &positions, const RandomDouble *random = NULL);
 
 	private:
-		void _init(void);		
-		void _computeMaskIndices(unsigned int imageIndex);
 		unsigned int _maxNFeatures;
-		NullableVector<AssociativeSortedList<unsigned int, unsigned int>> _sortedMaskPositions;
-		CImgList<double> *_images;
+		CImgList<float> *_images;
 		CImgList<double> *_featureList;
+		CImgList<unsigned char> *_siftList;
 		vector<unsigned int> *_labels;
-		CImgList<bool> *_masks;	  
+		vector<BitMask> *_masks;	  
 		CImg<double> *_positions;
 		bool _display;
 		unsigned int *_nDescriptorsPerImage;
+		const RandomDouble *_random;
+
+		double _getRandom(void) const;
+	};
+
+	/*! Hands out the descriptors of one image in batches, up to maxNFeatures: new random patches for HSL and Haar, 
+	 *  and for SIFT, whose keypoints are detected at once, the keypoints in random order. */
+	class DescriptorStream
+	{
+	public:
+		DescriptorStream(CImgList<float> &images, unsigned int imageIndex, unsigned int featureType, unsigned int maxNFeatures, unsigned int patchSize);
+		unsigned int next(unsigned int batchSize, CImg<double> &features);
+		unsigned int getNExtracted(void) const;
+
+	private:
+		CImgList<float> &_images;
+		unsigned int _imageIndex;
+		unsigned int _featureType;
+		unsigned int _maxNFeatures;
+		unsigned int _patchSize;
+		unsigned int _nExtracted;
+		CImg<double> _siftFeatures;
+	};
+
+	/*! Extracts the descriptors of a large image tile by tile on all cores, so that memory is bounded by the tiles in flight.
+	 *  Tiles overlap so that descriptors near their borders see their whole support, and a descriptor is only kept by the 
+	 *  tile whose core, the tile less half the overlap on its inner sides, holds its position. Uncompressed .cimg files are 
+	 *  read from disk one tile at a time, other formats are decoded once and only converted to HSL per tile. Each tile samples 
+	 *  from its own generator, seeded with seed plus its index, so that the descriptors do not depend on the scheduling. */
+	class TiledExtractor
+	{
+	public:
+		TiledExtractor(unsigned int featureType, unsigned int patchSize, unsigned int tileSize = 1024, unsigned int overlap = 64, int seed = 999);
+		unsigned int describe(const string &imagePath, unsigned int maxNFeatures, CImg<double> &features, CImg<double> &positions, unsigned int &width, unsigned int &height) const;
+
+	private:
+		static bool _getCimgSize(const string &imagePath, unsigned int &width, unsigned int &height);
+		void _getTile(unsigned int index, unsigned int nTiles, unsigned int size, unsigned int &first, unsigned int &last, unsigned int &coreFirst, unsigned int &coreLast) const;
+
+		unsigned int _featureType;
+		unsigned int _patchSize;
+		unsigned int _tileSize;
+		unsigned int _overlap;
+		int _seed;
 	};
 }
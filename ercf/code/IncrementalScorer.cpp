@@ -0,0 +1,83 @@
+#include "stdafx.h"
+#include "IncrementalScorer.h"
+
+using namespace ercf;
+
+IncrementalScorer::IncrementalScorer(const Classifier *classifier)
+	: _classifier(classifier), _nModels(classifier->getNModels())
+{
+	unsigned int nLeaves = classifier->_leafWeights.height() - 1;
+	_isTouched.assign((nLeaves + 31) / 32, 0);
+	_leafIndices.assign(classifier->_getNTrees(), 0);
+	reset();
+}
+
+/*! Starts a new image, in time proportional to the leaves touched by the previous one. */
+void IncrementalScorer::reset(void)
+{
+	for (unsigned int i = 0; i < _touchedLeaves.size(); ++i)
+	{
+		_isTouched[_touchedLeaves[i] >> 5] = 0;
+	}
+	_touchedLeaves.clear();
+
+	const double *bias = _classifier->_leafWeights.data() + (_classifier->_leafWeights.height() - 1) * _nModels;
+	_scores.assign(bias, bias + _nModels);
+}
+
+/*! Adds the descriptors stored as the columns of features. */
+void IncrementalScorer::add(const CImg<double> &features)
+{
+	const double *leafWeights = _classifier->_leafWeights.data();
+	for (unsigned int f = 0; f < features.width(); ++f)
+	{
+		_classifier->_getLeafIndices(_leafIndices.data(), features.get_column(f));
+		for (unsigned int t = 0; t < _leafIndices.size(); ++t)
+		{
+			unsigned int k = _leafIndices[t];
+			unsigned int bit = 1U << (k & 31);
+			if (_isTouched[k >> 5] & bit) continue;
+			_isTouched[k >> 5] |= bit;
+			_touchedLeaves.push_back(k);
+
+			const double *weights = leafWeights + k * _nModels;
+			for (unsigned int l = 0; l < _nModels; ++l)
+			{
+				_scores[l] += weights[l];
+			}
+		}
+	}
+}
+
+const vector<double> &IncrementalScorer::getScores(void) const
+{
+	return _scores;
+}
+
+/*! Label with the highest decision function. margin is its lead over the runner-up or, with a single model, its distance to the decision boundary. */
+unsigned int IncrementalScorer::getBest(double &margin) const
+{
+	unsigned int best = 0;
+	for (unsigned int l = 1; l < _nModels; ++l)
+	{
+		if (_scores[l] > _scores[best]) best = l;
+	}
+	if (_nModels == 1)
+	{
+		margin = fabs(_scores[0]);
+		return best;
+	}
+
+	double second = -numeric_limits<double>::max();
+	for (unsigned int l = 0; l < _nModels; ++l)
+	{
+		if (l != best) second = max(second, _scores[l]);
+	}
+	margin = _scores[best] - second;
+	return best;
+}
+
+unsigned int IncrementalScorer::getNTouchedLeaves(void) const
+{
+	return _touchedLeaves.size();
+}
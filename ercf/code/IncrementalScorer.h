@@ -0,0 +1,30 @@
+/*! \file */
+
+#pragma once
+#include "stdafx.h"
+#include "Classifier.h"
+
+namespace ercf
+{
+	/*! Decision functions of every label of a Classifier, kept up to date as the descriptors of an image stream in.
+	 *  The histogram is clipped to 1, so a leaf only adds its weights the first time it is reached: a bitset of touched 
+	 *  leaves replaces the histogram, and adding a descriptor costs one weight row per newly touched leaf. */
+	class IncrementalScorer
+	{
+	public:
+		IncrementalScorer(const Classifier *classifier);
+		void reset(void);
+		void add(const CImg<double> &features);
+		const vector<double> &getScores(void) const;
+		unsigned int getBest(double &margin) const;
+		unsigned int getNTouchedLeaves(void) const;
+
+	private:
+		const Classifier *_classifier;
+		unsigned int _nModels;
+		vector<unsigned int> _isTouched;
+		vector<unsigned int> _touchedLeaves;
+		vector<unsigned int> _leafIndices;
+		vector<double> _scores;
+	};
+}
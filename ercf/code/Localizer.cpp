@@ -0,0 +1,105 @@
+#include "stdafx.h"
+#include "Localizer.h"
+
+using namespace ercf;
+
+enum { TopSide = 0, BottomSide = 1, LeftSide = 2, RightSide = 3 };
+
+Localizer::Localizer(const Classifier *classifier, unsigned int cellSize)
+	: _classifier(classifier), _cellSize(max(cellSize, 1U))
+{
+}
+
+bool Localizer::BoxSet::operator<(const BoxSet &boxSet) const
+{
+	return bound < boxSet.bound;
+}
+
+/*! Sum of the cells from (left, top) to (right, bottom) included, 0 for an empty box. */
+double Localizer::_sum(const CImg<double> &integral, int left, int top, int right, int bottom) const
+{
+	if (left > right || top > bottom) return 0.;
+	return integral(right + 1, bottom + 1) - integral(left, bottom + 1) - integral(right + 1, top) + integral(left, top);
+}
+
+/*! No box of the set scores more than the positive weights of its largest box plus the negative weights of its smallest one. */
+double Localizer::_bound(const CImg<double> &positive, const CImg<double> &negative, const BoxSet &boxSet) const
+{
+	const int (*i)[2] = boxSet.intervals;
+	return _sum(positive, i[LeftSide][0], i[TopSide][0], i[RightSide][1], i[BottomSide][1]) + _sum(negative, i[LeftSide][1], i[TopSide][1], i[RightSide][0], i[BottomSide][0]);
+}
+
+/*! Returns the highest decision function of label over all boxes of a width x height image, whose descriptors are the columns of features
+ *  at positions, and that box in pixels as box[0..3] = x0, y0, x1, y1, included. */
+double Localizer::localize(const CImg<double> &features, const CImg<double> &positions, unsigned int width, unsigned int height, unsigned int label, unsigned int *box) const
+{
+	traceScope("localize");
+	vector<double> weights;
+	_classifier->getDescriptorWeights(features, label, weights);
+
+	int gridWidth = (width + _cellSize - 1) / _cellSize;
+	int gridHeight = (height + _cellSize - 1) / _cellSize;
+	CImg<double> positive(gridWidth + 1, gridHeight + 1);
+	CImg<double> negative(gridWidth + 1, gridHeight + 1);
+	positive.fill(0.);
+	negative.fill(0.);
+	for (unsigned int i = 0; i < weights.size(); ++i)
+	{
+		int x = min((int)positions(i, 0) / (int)_cellSize, gridWidth - 1);
+		int y = min((int)positions(i, 1) / (int)_cellSize, gridHeight - 1);
+		if (x < 0 || y < 0) continue;
+		if (weights[i] > 0.) positive(x + 1, y + 1) += weights[i];
+		else negative(x + 1, y + 1) += weights[i];
+	}
+	for (int y = 1; y <= gridHeight; ++y)
+	{
+		for (int x = 1; x <= gridWidth; ++x)
+		{
+			positive(x, y) += positive(x - 1, y) + positive(x, y - 1) - positive(x - 1, y - 1);
+			negative(x, y) += negative(x - 1, y) + negative(x, y - 1) - negative(x - 1, y - 1);
+		}
+	}
+
+	BoxSet boxSet;
+	boxSet.intervals[TopSide][0] = boxSet.intervals[BottomSide][0] = 0;
+	boxSet.intervals[TopSide][1] = boxSet.intervals[BottomSide][1] = gridHeight - 1;
+	boxSet.intervals[LeftSide][0] = boxSet.intervals[RightSide][0] = 0;
+	boxSet.intervals[LeftSide][1] = boxSet.intervals[RightSide][1] = gridWidth - 1;
+	boxSet.bound = _bound(positive, negative, boxSet);
+
+	priority_queue<BoxSet> boxSets;
+	boxSets.push(boxSet);
+	unsigned int nVisited = 0;
+	while (true)
+	{
+		boxSet = boxSets.top();
+		boxSets.pop();
+		++nVisited;
+
+		int widest = 0;
+		for (int s = 1; s < 4; ++s)
+		{
+			if (boxSet.intervals[s][1] - boxSet.intervals[s][0] > boxSet.intervals[widest][1] - boxSet.intervals[widest][0]) widest = s;
+		}
+		// A single box is left: its bound is its score, and no other set can beat it
+		if (boxSet.intervals[widest][0] == boxSet.intervals[widest][1]) break;
+
+		int middle = (boxSet.intervals[widest][0] + boxSet.intervals[widest][1]) / 2;
+		BoxSet halves[2] = {boxSet, boxSet};
+		halves[0].intervals[widest][1] = middle;
+		halves[1].intervals[widest][0] = middle + 1;
+		for (unsigned int h = 0; h < 2; ++h)
+		{
+			if (halves[h].intervals[LeftSide][0] > halves[h].intervals[RightSide][1] || halves[h].intervals[TopSide][0] > halves[h].intervals[BottomSide][1]) continue;
+			halves[h].bound = _bound(positive, negative, halves[h]);
+			boxSets.push(halves[h]);
+		}
+	}
+	Trace::counter("localize box sets", nVisited);
+
+	box[0] = boxSet.intervals[LeftSide][0] * _cellSize;
+	box[1] = boxSet.intervals[TopSide][0] * _cellSize;
+	box[2] = min((boxSet.intervals[RightSide][0] + 1) * _cellSize, width) - 1;
+	box[3] = min((boxSet.intervals[BottomSide][0] + 1) * _cellSize, height) - 1;
+	return _classifier->getBias(label) + boxSet.bound;
+}
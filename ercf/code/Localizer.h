@@ -0,0 +1,34 @@
+/*! \file */
+
+#pragma once
+#include "stdafx.h"
+#include "Classifier.h"
+
+namespace ercf
+{
+	/*! Finds the box of an image where the decision function of a label is highest, by efficient subwindow search.
+	 *  The decision function is taken without clipping, so that a box scores the bias plus the weights of the 
+	 *  descriptors inside it. Weights are summed over a grid of cellSize pixels into integral maps of their positive and 
+	 *  negative parts, from which a branch and bound over sets of boxes only visits a small part of all boxes. */
+	class Localizer
+	{
+	public:
+		Localizer(const Classifier *classifier, unsigned int cellSize = 8);
+		double localize(const CImg<double> &features, const CImg<double> &positions, unsigned int width, unsigned int height, unsigned int label, unsigned int *box) const;
+
+	private:
+		/*! Boxes whose top, bottom, left and right cells lie in the given closed intervals. */
+		struct BoxSet
+		{
+			int intervals[4][2];
+			double bound;
+			bool operator<(const BoxSet &boxSet) const;
+		};
+
+		double _sum(const CImg<double> &integral, int left, int top, int right, int bottom) const;
+		double _bound(const CImg<double> &positive, const CImg<double> &negative, const BoxSet &boxSet) const;
+
+		const Classifier *_classifier;
+		unsigned int _cellSize;
+	};
+}
@@ -0,0 +1,50 @@
+#include "stdafx.h"
+#include "ModelHandle.h"
+
+using namespace ercf;
+
+Model::Model(const string &forestPath, const string &classifierPath, unsigned int version)
+	: forest(forestPath), classifier(&forest), version(version)
+{
+	classifier.load(classifierPath);
+}
+
+/*! Whether the forest was parsed and the classifier was trained on its leaves, which classify relies on. */
+bool Model::isValid(void) const
+{
+	return forest.getNTrees() > 0 && classifier.getNModels() > 0 && classifier.getNLeaves() == forest.getNLeaves();
+}
+
+ModelHandle::ModelHandle(void)
+{
+	_version = 0;
+}
+
+shared_ptr<const Model> ModelHandle::get(void) const
+{
+	return atomic_load(&_model);
+}
+
+/*! Loads a forest and its classifier and publishes them. Returns the version of the new model, or 0 without publishing anything if 
+ *  a file is missing or unreadable, or if the classifier does not match the forest. */
+unsigned int ModelHandle::load(const string &forestPath, const string &classifierPath)
+{
+	if (!ifstream(forestPath.c_str()).good() || !ifstream(classifierPath.c_str(), ios::binary).good()) return 0;
+	shared_ptr<const Model> model;
+	try
+	{
+		model.reset(new Model(forestPath, classifierPath, ++_version));
+	}
+	catch (exception &)
+	{
+		return 0;
+	}
+	if (!model->isValid()) return 0;
+	publish(model);
+	return model->version;
+}
+
+void ModelHandle::publish(const shared_ptr<const Model> &model)
+{
+	atomic_store(&_model, model);
+}
@@ -0,0 +1,40 @@
+/*! \file */
+
+#pragma once
+#include "stdafx.h"
+#include "ErcForest.h"
+#include "Classifier.h"
+
+namespace ercf
+{
+	/*! A forest and the classifier trained on its leaves, loaded together and never modified afterwards. */
+	class Model
+	{
+	public:
+		Model(const string &forestPath, const string &classifierPath, unsigned int version);
+		bool isValid(void) const;
+		ErcForest forest;
+		Classifier classifier;
+		const unsigned int version;
+
+	private:
+		Model(const Model &model);
+		Model &operator=(const Model &model);
+	};
+
+	/*! Publishes the current model to concurrent readers.
+	 *  A reader pins the model with get() for the whole request, so publishing a new one never waits for nor disturbs 
+	 *  requests in flight: they finish on the model they started with, which is released with its last reader. */
+	class ModelHandle
+	{
+	public:
+		ModelHandle(void);
+		shared_ptr<const Model> get(void) const;
+		unsigned int load(const string &forestPath, const string &classifierPath);
+		void publish(const shared_ptr<const Model> &model);
+
+	private:
+		shared_ptr<const Model> _model;
+		atomic<unsigned int> _version;
+	};
+}
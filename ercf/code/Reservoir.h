@@ -0,0 +1,117 @@
+/*! \file */
+
+#pragma once
+#include "stdafx.h"
+#include "tools.h"
+
+namespace ercf
+{
+	/*! Uniform sample of the descriptors of each label seen so far, within a total budget split evenly between labels.
+	 *  Every label keeps its own reservoir (Algorithm R), so its share does not depend on how many of its descriptors
+	 *  stream in, and a label with fewer descriptors than its share keeps all of them. Descriptors are CImg columns of
+	 *  type T and remember the image they come from, so that the classifier can still build per-image histograms. */
+	template<typename T>
+	class Reservoir
+	{
+	public:
+		Reservoir(unsigned int nLabels, unsigned int maxNDescriptors, unsigned int seed = 999)
+			: _capacity(max(maxNDescriptors / max(nLabels, 1U), 1U)), _slots(nLabels), _nSeen(nLabels, 0), _random(0., 1., seed)
+		{
+		}
+
+		void add(const CImg<T> &descriptor, unsigned int label, unsigned int imageId)
+		{
+			vector<Slot> &slots = _slots[label];
+			unsigned int n = _nSeen[label]++;
+			if (slots.size() < _capacity)
+			{
+				slots.push_back(Slot());
+				slots.back().descriptor = descriptor;
+				slots.back().imageId = imageId;
+				return;
+			}
+			unsigned int j = min((unsigned int)((n + 1) * _random()), n);
+			if (j >= _capacity) return;
+			slots[j].descriptor = descriptor;
+			slots[j].imageId = imageId;
+		}
+
+		unsigned int getNSeen(unsigned int label) const
+		{
+			return _nSeen[label];
+		}
+
+		unsigned int getNDescriptors(unsigned int label) const
+		{
+			return _slots[label].size();
+		}
+
+		unsigned int getNDescriptors(void) const
+		{
+			unsigned int n = 0;
+			for (unsigned int l = 0; l < _slots.size(); ++l) n += _slots[l].size();
+			return n;
+		}
+
+		/*! Copies the sample to the columns of features, grouped by image in the order of their ids, with their labels, and
+		 *  the number of descriptors kept for each image that kept any, as Classifier::train expects. */
+		void get(CImg<T> &features, vector<unsigned int> &labels, vector<unsigned int> &nDescriptorsPerImage) const
+		{
+			_get(0, _slots.size(), features, labels, nDescriptorsPerImage);
+		}
+
+		/*! Copies the sample of label alone, as get does, which is final once no more descriptors of label stream in. */
+		void get(unsigned int label, CImg<T> &features, vector<unsigned int> &labels, vector<unsigned int> &nDescriptorsPerImage) const
+		{
+			_get(label, label + 1, features, labels, nDescriptorsPerImage);
+		}
+
+		/*! Frees the sample of label once it is stored elsewhere, its number of descriptors seen being kept. */
+		void release(unsigned int label)
+		{
+			vector<Slot>().swap(_slots[label]);
+		}
+
+	private:
+		struct Slot
+		{
+			CImg<T> descriptor;
+			unsigned int imageId;
+		};
+
+		void _get(unsigned int firstLabel, unsigned int lastLabel, CImg<T> &features, vector<unsigned int> &labels, vector<unsigned int> &nDescriptorsPerImage) const
+		{
+			vector<pair<unsigned int, const Slot *>> order;
+			for (unsigned int l = firstLabel; l < lastLabel; ++l)
+			{
+				for (unsigned int s = 0; s < _slots[l].size(); ++s) order.push_back(make_pair(l, &_slots[l][s]));
+			}
+			stable_sort(order.begin(), order.end(), [](const pair<unsigned int, const Slot *> &a, const pair<unsigned int, const Slot *> &b)
+			{
+				return a.second->imageId < b.second->imageId;
+			});
+
+			labels.resize(order.size());
+			nDescriptorsPerImage.clear();
+			if (order.empty())
+			{
+				features.assign();
+				return;
+			}
+			features.assign(order.size(), order[0].second->descriptor.size());
+			for (unsigned int i = 0; i < order.size(); ++i)
+			{
+				const CImg<T> &descriptor = order[i].second->descriptor;
+				cimg_forY(features, d) features(i, d) = descriptor[d];
+				labels[i] = order[i].first;
+				if (i == 0 || order[i].second->imageId != order[i - 1].second->imageId) nDescriptorsPerImage.push_back(0);
+				++nDescriptorsPerImage.back();
+			}
+		}
+
+		unsigned int _capacity;
+		vector<vector<Slot>> _slots;
+		vector<unsigned int> _nSeen;
+		RandomDouble _random;
+	};
+}
@@ -0,0 +1,285 @@
+#include "stdafx.h"
+#include "Server.h"
+#include "FeatureExtractor.h"
+
+#pragma comment(lib, "ws2_32.lib")
+
+using namespace ercf;
+
+InferenceServer::InferenceServer(ModelHandle *models, unsigned int featureType, unsigned int nWorkers, unsigned int maxBatchSize, unsigned int maxDelay)
+	: maxNDescriptors(8000), patchSize(16), maxNBytes(64 << 20), _models(models), _featureType(featureType), _nWorkers(max(nWorkers, 1U)), _socket(INVALID_SOCKET)
+{
+	_batchClassifier = new BatchClassifier(maxBatchSize, maxDelay);
+	_isStopping = false;
+	WSADATA wsaData;
+	WSAStartup(MAKEWORD(2, 2), &wsaData);
+}
+
+InferenceServer::~InferenceServer(void)
+{
+	stop();
+	for (unsigned int i = 0; i < _workers.size(); ++i)
+	{
+		_workers[i].join();
+	}
+	delete _batchClassifier;
+	WSACleanup();
+}
+
+bool InferenceServer::listen(const string &socketPath)
+{
+	_socketPath = socketPath;
+	SOCKET listening = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listening == INVALID_SOCKET) return false;
+
+	SOCKADDR_UN address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+	DeleteFile(socketPath.c_str());
+
+	if (bind(listening, (sockaddr *)&address, sizeof(address)) == SOCKET_ERROR || ::listen(listening, SOMAXCONN) == SOCKET_ERROR)
+	{
+		closesocket(listening);
+		return false;
+	}
+	_socket = listening;
+
+	for (unsigned int i = 0; i < _nWorkers; ++i)
+	{
+		_workers.push_back(thread(&InferenceServer::_work, this));
+	}
+	return true;
+}
+
+void InferenceServer::run(void)
+{
+	while (!_isStopping)
+	{
+		SOCKET client = accept(_socket.load(), NULL, NULL);
+		if (client == INVALID_SOCKET) continue;
+		{
+			lock_guard<mutex> lock(_clientsMutex);
+			_clients.push(client);
+		}
+		_clientsCondition.notify_one();
+	}
+}
+
+/*! Stops accepting connections and shuts the open ones down, which wakes the workers waiting for the next request of an idle 
+ *  connection, so that the destructor can join them. A request in flight is still scored but loses its answer. Can be called from 
+ *  any thread. */
+void InferenceServer::stop(void)
+{
+	if (_isStopping.exchange(true)) return;
+	SOCKET listening = _socket.exchange(INVALID_SOCKET);
+	if (listening != INVALID_SOCKET)
+	{
+		closesocket(listening);
+		DeleteFile(_socketPath.c_str());
+	}
+	{
+		lock_guard<mutex> lock(_clientsMutex);
+		for (set<SOCKET>::iterator client = _openClients.begin(); client != _openClients.end(); ++client) shutdown(*client, SD_BOTH);
+	}
+	_clientsCondition.notify_all();
+}
+
+void InferenceServer::_work(void)
+{
+	while (true)
+	{
+		SOCKET client;
+		{
+			unique_lock<mutex> lock(_clientsMutex);
+			_clientsCondition.wait(lock, [this]() { return _isStopping || !_clients.empty(); });
+			if (_clients.empty()) return;
+			client = _clients.front();
+			_clients.pop();
+			_openClients.insert(client);
+		}
+		_serve(client);
+		{
+			lock_guard<mutex> lock(_clientsMutex);
+			_openClients.erase(client);
+		}
+		shutdown(client, SD_BOTH);
+		closesocket(client);
+	}
+}
+
+void InferenceServer::_serve(SOCKET client)
+{
+	string buffer;
+	string line;
+	while (!_isStopping && _readLine(client, buffer, line))
+	{
+		stringstream request(line);
+		string command;
+		request >> command;
+
+		string response;
+		if (command == "PATH")
+		{
+			string imagePath = line.substr(min(line.size(), command.size() + 1));
+			response = classify(imagePath);
+		}
+		else if (command == "BYTES")
+		{
+			unsigned int n = 0;
+			string extension;
+			request >> n >> extension;
+			if (n > maxNBytes)
+			{
+				// The image is not read, so the rest of the connection cannot be parsed either
+				_write(client, _error("images are limited to " + to_string(maxNBytes) + " bytes") + "\n");
+				return;
+			}
+			string bytes;
+			if (!_readBytes(client, buffer, n, bytes)) return;
+			if (_isValidExtension(extension)) response = _classifyBytes(bytes, extension);
+			else response = _error("invalid extension \"" + extension + "\"");
+		}
+		else if (command == "RELOAD")
+		{
+			string forestPath;
+			string classifierPath;
+			request >> quoted(forestPath) >> quoted(classifierPath);
+			unsigned int version = _models->load(forestPath, classifierPath);
+			stringstream output;
+			if (version > 0) output << "{\"version\":" << version << "}";
+			else output << _error("cannot load \"" + forestPath + "\" and \"" + classifierPath + "\"");
+			response = output.str();
+		}
+		else response = _error("unknown command \"" + command + "\"");
+
+		if (!_write(client, response + "\n")) return;
+	}
+}
+
+string InferenceServer::classify(const string &imagePath) const
+{
+	traceScope("request");
+	shared_ptr<const Model> model = _models->get();
+	CImgList<float> imList;
+	CImg<double> features;
+	CImg<double> positions;
+	try
+	{
+		loadHslImages(imList, vector<string>(1, imagePath));
+	}
+	catch (CImgException &e)
+	{
+		return _error(e.what());
+	}
+
+	unsigned int nDescriptors = FeatureExtractor::describe(imList, 0, _featureType, maxNDescriptors, patchSize, features, positions);
+	if (nDescriptors == 0) return _error("no descriptor extracted");
+
+	future<vector<double>> labelScores = _batchClassifier->classify(model, features);
+
+	stringstream unmixed;
+	vector<double> values;
+	try
+	{
+		for (unsigned int l = 0; l < model->classifier.getNModels(); ++l)
+		{
+			if (l > 0) unmixed << ",";
+			unmixed << model->classifier.unmixedPoints(features, l);
+		}
+		values = labelScores.get();
+	}
+	catch (exception &e)
+	{
+		return _error(e.what());
+	}
+
+	stringstream scores;
+	for (unsigned int l = 0; l < values.size(); ++l)
+	{
+		if (l > 0) scores << ",";
+		scores << values[l];
+	}
+
+	stringstream output;
+	output << "{\"version\":" << model->version << ",\"descriptors\":" << nDescriptors << ",\"scores\":[" << scores.str() << "],\"unmixed\":[" << unmixed.str() << "]}";
+	return output.str();
+}
+
+string InferenceServer::_classifyBytes(const string &bytes, const string &extension) const
+{
+	char tempDir[MAX_PATH];
+	char tempFile[MAX_PATH];
+	GetTempPath(MAX_PATH, tempDir);
+	if (GetTempFileName(tempDir, "erc", 0, tempFile) == 0) return _error("cannot create a temporary file");
+	string imagePath = string(tempFile) + "." + extension;
+
+	ofstream file;
+	file.open(imagePath.c_str(), ios::trunc | ios::binary);
+	file.write(bytes.data(), bytes.size());
+	file.close();
+
+	string response = classify(imagePath);
+	DeleteFile(imagePath.c_str());
+	DeleteFile(tempFile);
+	return response;
+}
+
+/*! Accepts up to 5 alphanumeric characters, since the extension ends the path of the temporary file that the image is written to. */
+bool InferenceServer::_isValidExtension(const string &extension)
+{
+	if (extension.empty() || extension.size() > 5) return false;
+	for (unsigned int i = 0; i < extension.size(); ++i)
+	{
+		if (!isalnum((unsigned char)extension[i])) return false;
+	}
+	return true;
+}
+
+bool InferenceServer::_readLine(SOCKET client, string &buffer, string &line) const
+{
+	size_t end;
+	while ((end = buffer.find('\n')) == string::npos)
+	{
+		if (buffer.size() > maxLineSize) return false;
+		char chunk[4096];
+		int n = recv(client, chunk, sizeof(chunk), 0);
+		if (n <= 0) return false;
+		buffer.append(chunk, n);
+	}
+	line = buffer.substr(0, end);
+	if (line.size() > 0 && line[line.size() - 1] == '\r') line.erase(line.size() - 1);
+	buffer.erase(0, end + 1);
+	return true;
+}
+
+bool InferenceServer::_readBytes(SOCKET client, string &buffer, unsigned int n, string &bytes) const
+{
+	while (buffer.size() < n)
+	{
+		char chunk[65536];
+		int nRead = recv(client, chunk, sizeof(chunk), 0);
+		if (nRead <= 0) return false;
+		buffer.append(chunk, nRead);
+	}
+	bytes = buffer.substr(0, n);
+	buffer.erase(0, n);
+	return true;
+}
+
+bool InferenceServer::_write(SOCKET client, const string &message) const
+{
+	size_t sent = 0;
+	while (sent < message.size())
+	{
+		int n = send(client, message.data() + sent, message.size() - sent, 0);
+		if (n <= 0) return false;
+		sent += n;
+	}
+	return true;
+}
+
+string InferenceServer::_error(const string &message)
+{
+	return "{\"error\":\"" + escapeJson(message) + "\"}";
+}
\ No newline at end of file
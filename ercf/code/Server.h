@@ -0,0 +1,56 @@
+/*! \file */
+
+#pragma once
+#include "stdafx.h"
+#include "ModelHandle.h"
+#include "BatchClassifier.h"
+#include "tools.h"
+
+namespace ercf
+{
+	/*! Keeps the published model in memory and answers classification requests on a UNIX domain socket.
+	 *  A request is one line, either "PATH <image file>" or "BYTES <n> <extension>" followed by the n bytes 
+	 *  of an encoded image, at most maxNBytes with an alphanumeric extension, and is answered by one JSON line. 
+	 *  "RELOAD <forest file> <classifier file>", with paths quoted if they contain spaces, swaps the model 
+	 *  without interrupting requests in flight, and keeps the current one if the new one does not load. 
+	 *  Connections are served concurrently by a pool of worker threads, and their images are scored together 
+	 *  in batches. Only the owner of the process stops it, through stop. */
+	class InferenceServer
+	{
+	public:
+		static const unsigned int maxLineSize = 4096;
+
+		InferenceServer(ModelHandle *models, unsigned int featureType, unsigned int nWorkers, unsigned int maxBatchSize = 16, unsigned int maxDelay = 2000);
+		~InferenceServer(void);
+		bool listen(const string &socketPath);
+		void run(void);
+		void stop(void);
+		string classify(const string &imagePath) const;
+		unsigned int maxNDescriptors;
+		unsigned int patchSize;
+		unsigned int maxNBytes;
+
+	private:
+		void _work(void);
+		void _serve(SOCKET client);
+		bool _readLine(SOCKET client, string &buffer, string &line) const;
+		bool _readBytes(SOCKET client, string &buffer, unsigned int n, string &bytes) const;
+		bool _write(SOCKET client, const string &message) const;
+		string _classifyBytes(const string &bytes, const string &extension) const;
+		static bool _isValidExtension(const string &extension);
+		static string _error(const string &message);
+
+		ModelHandle *_models;
+		BatchClassifier *_batchClassifier;
+		unsigned int _featureType;
+		unsigned int _nWorkers;
+		atomic<SOCKET> _socket;
+		string _socketPath;
+		vector<thread> _workers;
+		queue<SOCKET> _clients;
+		set<SOCKET> _openClients;
+		mutex _clientsMutex;
+		condition_variable _clientsCondition;
+		atomic<bool> _isStopping;
+	};
+}
@@ -0,0 +1,232 @@
+#include "stdafx.h"
+#include "Trace.h"
+
+atomic<bool> Trace::_enabled(false);
+long long Trace::_origin = Trace::now();
+mutex Trace::_buffersMutex;
+vector<Trace::Buffer *> Trace::_buffers;
+
+long long Trace::now(void)
+{
+	return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Trace::enable(bool enabled)
+{
+	_enabled = enabled;
+}
+
+bool Trace::isEnabled(void)
+{
+	return _enabled;
+}
+
+Trace::Owner::Owner(void) : buffer(NULL)
+{
+}
+
+Trace::Owner::~Owner(void)
+{
+	if (buffer == NULL) return;
+	lock_guard<mutex> lock(_buffersMutex);
+	buffer->isRetired = true;
+}
+
+/*! Buffer of the calling thread, on its first event a retired one if any, so that pools and server threads coming and going do 
+ *  not add buffers. A reused buffer keeps the events and the thread id of the threads that had it. */
+Trace::Buffer &Trace::_buffer(void)
+{
+	thread_local Owner owner;
+	if (owner.buffer == NULL)
+	{
+		lock_guard<mutex> lock(_buffersMutex);
+		for (unsigned int b = 0; b < _buffers.size() && owner.buffer == NULL; ++b)
+		{
+			if (_buffers[b]->isRetired) owner.buffer = _buffers[b];
+		}
+		if (owner.buffer == NULL)
+		{
+			owner.buffer = new Buffer();
+			owner.buffer->next = 0;
+			owner.buffer->nDropped = 0;
+			owner.buffer->thread = _buffers.size();
+			_buffers.push_back(owner.buffer);
+		}
+		owner.buffer->isRetired = false;
+		owner.buffer->childTime.clear();
+	}
+	return *owner.buffer;
+}
+
+void Trace::_begin(void)
+{
+	_buffer().childTime.push_back(0);
+}
+
+void Trace::_end(const char *name, long long start)
+{
+	Buffer &buffer = _buffer();
+	Event event;
+	event.name = name;
+	event.start = start;
+	event.duration = now() - start;
+	event.self = event.duration - buffer.childTime.back();
+	event.value = 0.;
+	event.isCounter = false;
+	buffer.childTime.pop_back();
+	event.depth = buffer.childTime.size();
+	if (!buffer.childTime.empty()) buffer.childTime.back() += event.duration;
+	_record(buffer, event);
+}
+
+/*! Appends event, overwriting the oldest one once the buffer holds maxNEvents. */
+void Trace::_record(Buffer &buffer, const Event &event)
+{
+	lock_guard<mutex> lock(buffer.eventsMutex);
+	if (buffer.events.size() < maxNEvents) buffer.events.push_back(event);
+	else
+	{
+		buffer.events[buffer.next] = event;
+		++buffer.nDropped;
+	}
+	buffer.next = (buffer.next + 1) % maxNEvents;
+}
+
+/*! Copies the events of buffer, oldest first, while its thread may still be recording. */
+void Trace::_getEvents(Buffer &buffer, vector<Event> &events)
+{
+	lock_guard<mutex> lock(buffer.eventsMutex);
+	unsigned int oldest = (buffer.events.size() < maxNEvents) ? 0 : buffer.next;
+	events.assign(buffer.events.begin() + oldest, buffer.events.end());
+	events.insert(events.end(), buffer.events.begin(), buffer.events.begin() + oldest);
+}
+
+void Trace::counter(const char *name, double value)
+{
+	if (!_enabled) return;
+	Buffer &buffer = _buffer();
+	Event event;
+	event.name = name;
+	event.start = now();
+	event.duration = 0;
+	event.self = 0;
+	event.value = value;
+	event.depth = buffer.childTime.size();
+	event.isCounter = true;
+	_record(buffer, event);
+}
+
+void Trace::clear(void)
+{
+	lock_guard<mutex> lock(_buffersMutex);
+	for (unsigned int b = 0; b < _buffers.size(); ++b)
+	{
+		lock_guard<mutex> bufferLock(_buffers[b]->eventsMutex);
+		_buffers[b]->events.clear();
+		_buffers[b]->next = 0;
+		_buffers[b]->nDropped = 0;
+	}
+	_origin = now();
+}
+
+void Trace::exportChromeJson(const string &jsonFile)
+{
+	lock_guard<mutex> lock(_buffersMutex);
+	ofstream file;
+	file.open(jsonFile.c_str(), ios::trunc);
+	file << "{\"traceEvents\":[";
+	bool first = true;
+	vector<Event> events;
+	for (unsigned int b = 0; b < _buffers.size(); ++b)
+	{
+		_getEvents(*_buffers[b], events);
+		for (unsigned int e = 0; e < events.size(); ++e)
+		{
+			if (!first) file << ",";
+			first = false;
+			file << "{\"name\":\"" << events[e].name << "\",\"pid\":1,\"tid\":" << _buffers[b]->thread << ",\"ts\":" << (events[e].start - _origin) / 1000.;
+			if (events[e].isCounter) file << ",\"ph\":\"C\",\"args\":{\"value\":" << events[e].value << "}}";
+			else file << ",\"ph\":\"X\",\"dur\":" << events[e].duration / 1000. << "}";
+		}
+	}
+	file << "]}";
+	file.close();
+}
+
+void Trace::printSummary(ostream &output)
+{
+	struct Total
+	{
+		unsigned int count;
+		long long total;
+		long long self;
+		double sum;
+		double max;
+		bool isCounter;
+	};
+
+	lock_guard<mutex> lock(_buffersMutex);
+	ios::fmtflags flags = output.flags();
+	map<string, Total> totals;
+	long long wall = 0;
+	unsigned long long nDropped = 0;
+	vector<Event> events;
+	for (unsigned int b = 0; b < _buffers.size(); ++b)
+	{
+		_getEvents(*_buffers[b], events);
+		{
+			lock_guard<mutex> bufferLock(_buffers[b]->eventsMutex);
+			nDropped += _buffers[b]->nDropped;
+		}
+		for (unsigned int e = 0; e < events.size(); ++e)
+		{
+			const Event &event = events[e];
+			map<string, Total>::iterator it = totals.find(event.name);
+			if (it == totals.end())
+			{
+				Total total = {0, 0, 0, 0., event.isCounter ? event.value : (double)event.duration, event.isCounter};
+				it = totals.insert(make_pair(string(event.name), total)).first;
+			}
+			Total &total = it->second;
+			++total.count;
+			total.total += event.duration;
+			total.self += event.self;
+			total.sum += event.value;
+			total.max = max(total.max, event.isCounter ? event.value : (double)event.duration);
+			if (!event.isCounter && event.depth == 0) wall = max(wall, event.start + event.duration - _origin);
+		}
+	}
+
+	output << left << setw(20) << "span" << right << setw(10) << "calls" << setw(14) << "total (ms)" << setw(14) << "self (ms)" << setw(14) << "mean (ms)" << setw(14) << "max (ms)" << setw(9) << "self %" << endl;
+	for (map<string, Total>::const_iterator it = totals.begin(); it != totals.end(); ++it)
+	{
+		const Total &total = it->second;
+		if (total.isCounter) continue;
+		output << left << setw(20) << it->first << right << setw(10) << total.count << fixed << setprecision(3)
+			<< setw(14) << total.total / 1e6 << setw(14) << total.self / 1e6 << setw(14) << total.total / 1e6 / total.count << setw(14) << total.max / 1e6
+			<< setw(9) << setprecision(1) << ((wall > 0) ? 100. * total.self / wall : 0.) << endl;
+	}
+
+	output << left << setw(20) << "counter" << right << setw(10) << "samples" << setw(14) << "sum" << setw(14) << "mean" << setw(14) << "max" << endl;
+	for (map<string, Total>::const_iterator it = totals.begin(); it != totals.end(); ++it)
+	{
+		const Total &total = it->second;
+		if (!total.isCounter) continue;
+		output << left << setw(20) << it->first << right << setw(10) << total.count << fixed << setprecision(3)
+			<< setw(14) << total.sum << setw(14) << total.sum / total.count << setw(14) << total.max << endl;
+	}
+	if (nDropped > 0) output << nDropped << " oldest events dropped, beyond " << maxNEvents << " per thread." << endl;
+	output.flags(flags);
+}
+
+Trace::Span::Span(const char *name) : _name(name), _isRecorded(Trace::isEnabled())
+{
+	if (!_isRecorded) return;
+	Trace::_begin();
+	_start = Trace::now();
+}
+
+Trace::Span::~Span(void)
+{
+	if (_isRecorded) Trace::_end(_name, _start);
+}
@@ -0,0 +1,84 @@
+/*! \file */
+
+#pragma once
+#include "stdafx.h"
+
+/*! Scoped wall-clock tracing, off unless enabled.
+ *  Spans and counters are recorded into per-thread ring buffers of maxNEvents,
+ *  which keep the latest events of long runs. A buffer's lock is only contended
+ *  while clearing or exporting. Buffers are only merged when exporting.
+ *  The buffer of an exited thread keeps its events and is handed to the next
+ *  thread that records, so memory is bounded by the threads alive at once. */
+class Trace
+{
+public:
+	static const unsigned int maxNEvents = 1 << 18;
+
+
+	struct Event
+	{
+		const char *name;
+		long long start;
+		long long duration;
+		long long self;
+		double value;
+		unsigned int depth;
+		bool isCounter;
+	};
+
+	class Span
+	{
+	public:
+		Span(const char *name);
+		~Span(void);
+
+	private:
+		const char *_name;
+		long long _start;
+		bool _isRecorded;
+	};
+
+	static long long now(void);
+	static void enable(bool enabled);
+	static bool isEnabled(void);
+	static void counter(const char *name, double value);
+	static void clear(void);
+	static void exportChromeJson(const string &jsonFile);
+	static void printSummary(ostream &output);
+
+private:
+	struct Buffer
+	{
+		unsigned int thread;
+		/*! Ring of the latest events, the oldest one at next once it is full. */
+		vector<Event> events;
+		unsigned int next;
+		unsigned long long nDropped;
+		mutex eventsMutex;
+		vector<long long> childTime;
+		bool isRetired;
+	};
+
+	/*! Retires the buffer of its thread when the thread exits. */
+	struct Owner
+	{
+		Buffer *buffer;
+		Owner(void);
+		~Owner(void);
+	};
+
+	static Buffer &_buffer(void);
+	static void _begin(void);
+	static void _end(const char *name, long long start);
+	static void _record(Buffer &buffer, const Event &event);
+	static void _getEvents(Buffer &buffer, vector<Event> &events);
+
+	static atomic<bool> _enabled;
+	static long long _origin;
+	static mutex _buffersMutex;
+	static vector<Buffer *> _buffers;
+};
+
+#define traceConcat_(a, b) a##b
+#define traceConcat(a, b) traceConcat_(a, b)
+#define traceScope(name) Trace::Span traceConcat(_traceSpan, __LINE__)(name)
@@ -4,16 +4,38 @@
 
 using namespace ercf;
 
-TrainingSet::TrainingSet(void)
+double TrainingSet::_nLogNTable[TrainingSet::nLogNTableSize];
+const bool TrainingSet::_isNLogNTableInitialized = TrainingSet::_initNLogNTable();
+
+bool TrainingSet::_initNLogNTable(void)
 {
+	_nLogNTable[0] = 0.;
+	for (unsigned int n = 1; n < nLogNTableSize; ++n) _nLogNTable[n] = n * log((double)n);
+	return true;
 }
 
-TrainingSet::TrainingSet(CImg<double> *features, vector<unsigned int> *labels, unsigned int nLabels): _features(features), _labels(labels), _nLabels(nLabels)
+TrainingSet::TrainingSet(void) : _features(NULL), _byteFeatures(NULL), _hasHistograms(false), _parent(NULL), _sibling(NULL)
+{
+}
+
+TrainingSet::TrainingSet(CImg<double> *features, vector<unsigned int> *labels, unsigned int nLabels): _features(features), _byteFeatures(NULL), _labels(labels), _nLabels(nLabels), _hasHistograms(false), _parent(NULL), _sibling(NULL)
 {
 	_nPoints = _features->width();
+	_initIndices();
+}
+
+/*! Training set over byte descriptors: thresholds are tested in the integer domain and the matrix takes an eighth of the memory of doubles. */
+TrainingSet::TrainingSet(CImg<unsigned char> *features, vector<unsigned int> *labels, unsigned int nLabels): _features(NULL), _byteFeatures(features), _labels(labels), _nLabels(nLabels), _hasHistograms(false), _parent(NULL), _sibling(NULL)
+{
+	_nPoints = _byteFeatures->width();
+	_initIndices();
+}
+
+void TrainingSet::_initIndices(void)
+{
 	_indices.assign(_nPoints, 0);
-	_maxFeatures.assign(_features->height(), 0.);
-	_minFeatures.assign(_features->height(), 0.);
+	_maxFeatures.assign(getFeatureDim(), 0.);
+	_minFeatures.assign(getFeatureDim(), 0.);
 	
 	for (int i = 0; i < _nPoints; ++i)
 	{
@@ -32,27 +54,33 @@ void TrainingSet::computeLabelOccurences(void)
 }
 
 
-TrainingSet::TrainingSet(CImg<double> *features, vector<unsigned int> *labels, unsigned int nLabels, vector<unsigned int> &indices, unsigned int nPoints): _features(features), _labels(labels), _nLabels(nLabels), _indices(indices), _nPoints(nPoints)
+TrainingSet::TrainingSet(CImg<double> *features, vector<unsigned int> *labels, unsigned int nLabels, vector<unsigned int> &indices, unsigned int nPoints): _features(features), _byteFeatures(NULL), _labels(labels), _nLabels(nLabels), _indices(indices), _nPoints(nPoints), _hasHistograms(false), _parent(NULL), _sibling(NULL)
 {
-	_maxFeatures.assign(_features->height(), 0.);
-	_minFeatures.assign(_features->height(), 0.);
+	_maxFeatures.assign(getFeatureDim(), 0.);
+	_minFeatures.assign(getFeatureDim(), 0.);
 	computeLabelOccurences();
 }
 
-TrainingSet::TrainingSet(const TrainingSet &set): _features(set._features), _labels(set._labels), _nLabels(set._nLabels), _nPoints(0)
+TrainingSet::TrainingSet(const TrainingSet &set): _features(set._features), _byteFeatures(set._byteFeatures), _labels(set._labels), _nLabels(set._nLabels), _nPoints(0), _bins(set._bins), _hasHistograms(false), _parent(NULL), _sibling(NULL)
 {
-	_maxFeatures.assign(_features->height(), 0.);
-	_minFeatures.assign(_features->height(), 0.);
+	_maxFeatures.assign(getFeatureDim(), 0.);
+	_minFeatures.assign(getFeatureDim(), 0.);
 }
 
 TrainingSet &TrainingSet::operator=(const TrainingSet &set)
 {
 	_features = set._features;
+	_byteFeatures = set._byteFeatures;
 	_labels = set._labels;
 	_nLabels = set._nLabels;
 	_nPoints = 0;
-	_maxFeatures.assign(_features->height(), 0.);
-	_minFeatures.assign(_features->height(), 0.);
+	_maxFeatures.assign(getFeatureDim(), 0.);
+	_minFeatures.assign(getFeatureDim(), 0.);
+	_bins = set._bins;
+	_histograms.assign(0, CImg<unsigned int>());
+	_hasHistograms = false;
+	_parent = NULL;
+	_sibling = NULL;
 	return *this;
 }
 
@@ -62,35 +90,77 @@ TrainingSet::~TrainingSet(void)
 
 unsigned int TrainingSet::getFeatureDim() const
 {
-	return _features->height();
+	return (_byteFeatures != NULL) ? _byteFeatures->height() : _features->height();
+}
+
+/*! Whether features only take integer values, so that thresholds can be rounded up without changing any partition. */
+bool TrainingSet::isIntegral(void) const
+{
+	return _byteFeatures != NULL;
 }
 
 double TrainingSet::getMinFeature(unsigned int index)
 {
-	if (_minFeatures.isNull(index))
-	{
-		double m = getPointFeature(0, index);
-		for (unsigned int p = 1; p < getNPoints(); ++p)
-		{
-			m = min(m, getPointFeature(p, index));
-		}
-		_minFeatures.set(index, m);
-	}
+	if (_minFeatures.isNull(index)) computeMinMaxFeatures(&index, 1);
 	return _minFeatures[index];
 }
 
 double TrainingSet::getMaxFeature(unsigned int index)
 {
-	if (_maxFeatures.isNull(index))
+	if (_maxFeatures.isNull(index)) computeMinMaxFeatures(&index, 1);
+	return _maxFeatures[index];
+}
+
+void TrainingSet::computeMinMaxFeatures(const unsigned int *featureIndices, unsigned int nFeatures)
+{
+	vector<unsigned int> missing;
+	for (unsigned int k = 0; k < nFeatures; ++k)
 	{
-		double m = getPointFeature(0, index);
-		for (unsigned int p = 1; p < getNPoints(); ++p)
+		unsigned int f = featureIndices[k];
+		if ((_minFeatures.isNull(f) || _maxFeatures.isNull(f)) && find(missing.begin(), missing.end(), f) == missing.end()) missing.push_back(f);
+	}
+	if (missing.size() == 0) return;
+
+	vector<double> mins(missing.size());
+	vector<double> maxs(missing.size());
+	if (_byteFeatures != NULL) _computeMinMaxFeatures(*_byteFeatures, missing, mins, maxs);
+	else _computeMinMaxFeatures(*_features, missing, mins, maxs);
+
+	for (unsigned int k = 0; k < missing.size(); ++k)
+	{
+		_minFeatures.set(missing[k], mins[k]);
+		_maxFeatures.set(missing[k], maxs[k]);
+	}
+}
+
+template<typename T>
+void TrainingSet::_computeMinMaxFeatures(const CImg<T> &features, const vector<unsigned int> &missing, vector<double> &mins, vector<double> &maxs) const
+{
+	unsigned int width = features.width();
+	const T *data = features.data();
+	for (unsigned int k = 0; k < missing.size(); ++k)
+	{
+		mins[k] = maxs[k] = data[_indices[0] + missing[k] * width];
+	}
+
+	for (unsigned int p0 = 0; p0 < getNPoints(); p0 += splitBlockSize)
+	{
+		unsigned int p1 = min(p0 + splitBlockSize, getNPoints());
+		for (unsigned int k = 0; k < missing.size(); ++k)
 		{
-			m = max(m, getPointFeature(p, index));
+			const T *row = data + missing[k] * width;
+			T m = (T)mins[k];
+			T M = (T)maxs[k];
+			for (unsigned int p = p0; p < p1; ++p)
+			{
+				T val = row[_indices[p]];
+				m = min(m, val);
+				M = max(M, val);
+			}
+			mins[k] = m;
+			maxs[k] = M;
 		}
-		_maxFeatures.set(index, m);
 	}
-	return _maxFeatures[index];
 }
 
 unsigned int TrainingSet::getLabelOccurences(unsigned int label) const
@@ -100,20 +170,25 @@ unsigned int TrainingSet::getLabelOccurences(unsigned int label) const
 
 double TrainingSet::getLabelEntropy(void) const
 {
-	double entropy = 0.;
+	if (getNPoints() == 0) return 0.;
+	double sum = 0.;
 	for (unsigned int i = 0; i < _nLabels; ++i)
 	{
-		double p = getLabelOccurences(i) / (double)getNPoints();
-		entropy += -xLogX(p);
+		sum += nLogN(getLabelOccurences(i));
 	}
-	return entropy;
+	return (nLogN(getNPoints()) - sum) / getNPoints();
 }
 
 double TrainingSet::getPartitionEntropy(const TrainingSet &set1, const TrainingSet &set2)
 {
-	double p1 = set1.getNPoints() / (double)(set1.getNPoints() + set2.getNPoints());
-	double entropy = -xLogX(p1) - xLogX(1. - p1);
-	return entropy;
+	return getPartitionEntropy(set1.getNPoints(), set2.getNPoints());
+}
+
+double TrainingSet::getPartitionEntropy(unsigned int nPoints1, unsigned int nPoints2)
+{
+	unsigned int nPoints = nPoints1 + nPoints2;
+	if (nPoints == 0) return 0.;
+	return (nLogN(nPoints) - nLogN(nPoints1) - nLogN(nPoints2)) / nPoints;
 }
 
 
@@ -131,15 +206,20 @@ double TrainingSet::getLabelPartitionJointEntropy(const TrainingSet &set1, const
 		++labelSetOccurences(set2.getPointLabel(i), 1);
 	}
 
-	double entropy = 0.;
-	for (unsigned int l = 0; l < set1.getNLabels(); ++l)
-		for (unsigned int s = 0; s < 2; ++s)
-		{
-			double p = labelSetOccurences(l, s) / (double)(set1.getNPoints() + set2.getNPoints());
-			entropy += -xLogX(p);
-		}
+	return getLabelPartitionJointEntropy(labelSetOccurences.data(), set1.getNLabels());
+}
 
-	return entropy;
+double TrainingSet::getLabelPartitionJointEntropy(const unsigned int *labelSetOccurences, unsigned int nLabels)
+{
+	unsigned int nPoints = 0;
+	double sum = 0.;
+	for (unsigned int i = 0; i < 2 * nLabels; ++i)
+	{
+		nPoints += labelSetOccurences[i];
+		sum += nLogN(labelSetOccurences[i]);
+	}
+	if (nPoints == 0) return 0.;
+	return (nLogN(nPoints) - sum) / nPoints;
 }
 
 unsigned int TrainingSet::getPointLabel(unsigned int index) const
@@ -149,6 +229,7 @@ unsigned int TrainingSet::getPointLabel(unsigned int index) const
 
 double TrainingSet::getPointFeature(unsigned int pointIndex, unsigned int featureIndex) const
 {
+	if (_byteFeatures != NULL) return _byteFeatures->operator()(_indices[pointIndex], featureIndex);
 	return _features->operator()(_indices[pointIndex], featureIndex);
 }
 
@@ -167,14 +248,51 @@ void TrainingSet::addPointIndex(unsigned int index)
 	_indices[_nPoints++] = index;
 }
 
+/*! Draws nPoints of the points with replacement into sample, a copy of this set, as indices sorted to keep the feature reads in memory order. */
+void TrainingSet::sample(unsigned int nPoints, TrainingSet &sample) const
+{
+	sample.flushIndices(nPoints);
+	for (unsigned int i = 0; i < nPoints; ++i)
+	{
+		sample.addPointIndex(_indices[min((unsigned int)(RandomDouble::Default() * getNPoints()), getNPoints() - 1)]);
+	}
+	sort(sample._indices.begin(), sample._indices.begin() + nPoints);
+	sample.computeLabelOccurences();
+}
+
+/*! Keeps in subset, a copy of this set, the points at pointIndices in this set. */
+void TrainingSet::select(const vector<unsigned int> &pointIndices, TrainingSet &subset) const
+{
+	subset.flushIndices(pointIndices.size());
+	for (unsigned int i = 0; i < pointIndices.size(); ++i)
+	{
+		subset.addPointIndex(_indices[pointIndices[i]]);
+	}
+	subset.computeLabelOccurences();
+}
+
 void TrainingSet::partition(unsigned int testFeatureIndex, double testThreshold, TrainingSet &set1, TrainingSet &set2) const
 {
 	set1.flushIndices(getNPoints());
 	set2.flushIndices(getNPoints());
 
+	if (_byteFeatures != NULL) _partition(*_byteFeatures, testFeatureIndex, testThreshold, set1, set2);
+	else _partition(*_features, testFeatureIndex, testThreshold, set1, set2);
+
+	set1.computeLabelOccurences();
+	set2.computeLabelOccurences();
+	set1._parent = set2._parent = this;
+	set1._sibling = &set2;
+	set2._sibling = &set1;
+}
+
+template<typename T>
+void TrainingSet::_partition(const CImg<T> &features, unsigned int testFeatureIndex, double testThreshold, TrainingSet &set1, TrainingSet &set2) const
+{
+	const T *row = features.data() + testFeatureIndex * features.width();
 	for (int i = 0; i < getNPoints(); ++i)
 	{
-		if (getPointFeature(i, testFeatureIndex) < testThreshold)
+		if (row[_indices[i]] < testThreshold)
 		{
 			set1.addPointIndex(_indices[i]);
 		}
@@ -183,10 +301,45 @@ void TrainingSet::partition(unsigned int testFeatureIndex, double testThreshold,
 			set2.addPointIndex(_indices[i]);
 		}
 	}
-	set1.computeLabelOccurences();
-	set2.computeLabelOccurences();
 }
 
+void TrainingSet::evaluateSplits(const unsigned int *testFeatureIndices, const double *testThresholds, unsigned int nCandidates, unsigned int *labelSetOccurences) const
+{
+	if (_byteFeatures != NULL) _evaluateSplits(*_byteFeatures, testFeatureIndices, testThresholds, nCandidates, labelSetOccurences);
+	else _evaluateSplits(*_features, testFeatureIndices, testThresholds, nCandidates, labelSetOccurences);
+}
+
+template<typename T>
+void TrainingSet::_evaluateSplits(const CImg<T> &features, const unsigned int *testFeatureIndices, const double *testThresholds, unsigned int nCandidates, unsigned int *labelSetOccurences) const
+{
+	unsigned int stride = 2 * _nLabels;
+	fill(labelSetOccurences, labelSetOccurences + nCandidates * stride, 0U);
+
+	unsigned int width = features.width();
+	const T *data = features.data();
+	const unsigned int *labels = _labels->data();
+	unsigned int blockLabels[splitBlockSize];
+	for (unsigned int p0 = 0; p0 < getNPoints(); p0 += splitBlockSize)
+	{
+		unsigned int p1 = min(p0 + splitBlockSize, getNPoints());
+		for (unsigned int p = p0; p < p1; ++p)
+		{
+			blockLabels[p - p0] = labels[_indices[p]];
+		}
+
+		for (unsigned int k = 0; k < nCandidates; ++k)
+		{
+			const T *row = data + testFeatureIndices[k] * width;
+			double threshold = testThresholds[k];
+			unsigned int *occurences = labelSetOccurences + k * stride;
+			for (unsigned int p = p0; p < p1; ++p)
+			{
+				unsigned int side = (row[_indices[p]] < threshold) ? 0 : _nLabels;
+				++occurences[blockLabels[p - p0] + side];
+			}
+		}
+	}
+}
 
 bool TrainingSet::isIndivisible(void) const
 {
@@ -207,6 +360,88 @@ void TrainingSet::flushIndices(unsigned int newMaxSize)
 	_nPoints = 0;
 	_indices.assign(newMaxSize, 0);
 	_labelOccurences.clear();
+	_flushHistograms();
+}
+
+void TrainingSet::setNBins(unsigned int nBins)
+{
+	_bins = make_shared<Bins>();
+	_bins->nBins = nBins;
+	_bins->origins.assign(getFeatureDim(), 0.);
+	_bins->widths.assign(getFeatureDim(), 0.);
+	_flushHistograms();
+}
+
+unsigned int TrainingSet::getNBins(void) const
+{
+	return (_bins == NULL) ? 0 : _bins->nBins;
+}
+
+void TrainingSet::_flushHistograms(void)
+{
+	if (!_hasHistograms) return;
+	_histograms.assign(0, CImg<unsigned int>());
+	_hasHistograms = false;
+}
+
+void TrainingSet::_computeBins(unsigned int featureIndex)
+{
+	if (!_bins->origins.isNull(featureIndex)) return;
+	if (_byteFeatures != NULL) _computeBins(*_byteFeatures, featureIndex);
+	else _computeBins(*_features, featureIndex);
+}
+
+template<typename T>
+void TrainingSet::_computeBins(const CImg<T> &features, unsigned int featureIndex)
+{
+	double m = features(0, featureIndex);
+	double M = m;
+	for (unsigned int p = 1; p < features.width(); ++p)
+	{
+		m = min(m, (double)features(p, featureIndex));
+		M = max(M, (double)features(p, featureIndex));
+	}
+	_bins->origins.set(featureIndex, m);
+	_bins->widths.set(featureIndex, (M > m) ? (M - m) / _bins->nBins : 1.);
+}
+
+double TrainingSet::getBinThreshold(unsigned int featureIndex, unsigned int bin) const
+{
+	return _bins->origins[featureIndex] + bin * _bins->widths[featureIndex];
+}
+
+const CImg<unsigned int> &TrainingSet::getHistogram(unsigned int featureIndex)
+{
+	if (!_hasHistograms)
+	{
+		_histograms.assign(getFeatureDim(), CImg<unsigned int>());
+		_hasHistograms = true;
+	}
+	if (!_histograms.isNull(featureIndex)) return _histograms[featureIndex];
+
+	_computeBins(featureIndex);
+	CImg<unsigned int> &histogram = _histograms[featureIndex];
+	if (_parent != NULL && _sibling != NULL && _parent->_hasHistograms && _sibling->_hasHistograms 
+		&& !_parent->_histograms.isNull(featureIndex) && !_sibling->_histograms.isNull(featureIndex))
+	{
+		histogram = _parent->_histograms[featureIndex];
+		histogram -= _sibling->_histograms[featureIndex];
+	}
+	else
+	{
+		histogram.assign(_bins->nBins, _nLabels);
+		histogram.fill(0);
+		double origin = _bins->origins[featureIndex];
+		double width = _bins->widths[featureIndex];
+		for (unsigned int p = 0; p < getNPoints(); ++p)
+		{
+			int bin = (int)((getPointFeature(p, featureIndex) - origin) / width);
+			bin = max(0, min(bin, (int)_bins->nBins - 1));
+			++histogram(bin, getPointLabel(p));
+		}
+	}
+	_histograms.set(featureIndex);
+	return histogram;
 }
 
 bool TrainingSet::isUnmixed(void) const
@@ -219,7 +454,15 @@ bool TrainingSet::isUnmixed(void) const
 	return emptyCount == _nLabels - 1;
 }
 
+/*! Column of a point as doubles, converted from bytes for a byte set, on which getPointByteFeature avoids the conversion. */
 CImg<double> TrainingSet::getPointFeature(unsigned int pointIndex) const
 {
+	if (_byteFeatures != NULL) return _byteFeatures->get_column(_indices[pointIndex]);
 	return _features->get_column(_indices[pointIndex]);
+}
+
+/*! Column of a point of a byte set, as bytes. */
+CImg<unsigned char> TrainingSet::getPointByteFeature(unsigned int pointIndex) const
+{
+	return _byteFeatures->get_column(_indices[pointIndex]);
 }
\ No newline at end of file
@@ -9,26 +9,45 @@ namespace ercf
 	class TrainingSet
 	{
 	public:
+		/*! Number of points processed per block by the multi-feature passes, sized to keep a block of indices and labels in L1. */
+		static const unsigned int splitBlockSize = 256;
+		/*! Counts below which n log(n) is read from a table, which then fits in L1. */
+		static const unsigned int nLogNTableSize = 4096;
+
 		TrainingSet(void);
 		TrainingSet(const TrainingSet &set);
 		TrainingSet(CImg<double> *features, vector<unsigned int> *labels, unsigned int nLabels);
 		TrainingSet(CImg<double> *features, vector<unsigned int> *labels, unsigned int nLabels, vector<unsigned int> &indices, unsigned int nPoints);
+		TrainingSet(CImg<unsigned char> *features, vector<unsigned int> *labels, unsigned int nLabels);
 		~TrainingSet(void);
 		TrainingSet &operator=(const TrainingSet &set);
 		void getSubset(unsigned int featureIndex, double featureThreshold, TrainingSet &leftSet, TrainingSet &rightSet) const;		
 		unsigned int getFeatureDim(void) const;
+		bool isIntegral(void) const;
 		unsigned int getNLabels(void) const;
 		unsigned int getNPoints(void) const;
 		unsigned int getPointLabel(unsigned int index) const;
 		double getPointFeature(unsigned int pointIndex, unsigned int featureIndex) const;
 		CImg<double> getPointFeature(unsigned int pointIndex) const;
+		CImg<unsigned char> getPointByteFeature(unsigned int pointIndex) const;
 		double getMinFeature(unsigned int index);
 		double getMaxFeature(unsigned int index);
 		double getLabelEntropy(void) const;
 		static double getPartitionEntropy(const TrainingSet &set1, const TrainingSet &set2);
+		static double getPartitionEntropy(unsigned int nPoints1, unsigned int nPoints2);
 		static double getLabelPartitionJointEntropy(const TrainingSet &set1, const TrainingSet &set2);
+		static double getLabelPartitionJointEntropy(const unsigned int *labelSetOccurences, unsigned int nLabels);
+		static double nLogN(unsigned int n);
+		void setNBins(unsigned int nBins);
+		unsigned int getNBins(void) const;
+		const CImg<unsigned int> &getHistogram(unsigned int featureIndex);
+		double getBinThreshold(unsigned int featureIndex, unsigned int bin) const;
 		void partition(unsigned int testFeatureIndex, double testThreshold, TrainingSet &set1, TrainingSet &set2) const;
+		void evaluateSplits(const unsigned int *testFeatureIndices, const double *testThresholds, unsigned int nCandidates, unsigned int *labelSetOccurences) const;
+		void computeMinMaxFeatures(const unsigned int *featureIndices, unsigned int nFeatures);
 		void addPointIndex(unsigned int index);
+		void sample(unsigned int nPoints, TrainingSet &sample) const;
+		void select(const vector<unsigned int> &pointIndices, TrainingSet &subset) const;
 		bool isIndivisible(void) const;
 		void flushIndices(unsigned int newMaxSize);
 		unsigned int getLabelOccurences(unsigned int label) const;
@@ -37,8 +56,28 @@ namespace ercf
 		void computeLabelOccurences(void);
 
 	private:
+		/*! Fixed bin edges over the whole feature matrix, shared by every subset so that histograms can be subtracted. */
+		struct Bins
+		{
+			unsigned int nBins;
+			NullableVector<double> origins;
+			NullableVector<double> widths;
+		};
+
+		void _initIndices(void);
 		void _computeMinMaxFeatures(void);		
+		void _computeBins(unsigned int featureIndex);
+		template<typename T> void _computeMinMaxFeatures(const CImg<T> &features, const vector<unsigned int> &missing, vector<double> &mins, vector<double> &maxs) const;
+		template<typename T> void _computeBins(const CImg<T> &features, unsigned int featureIndex);
+		template<typename T> void _partition(const CImg<T> &features, unsigned int testFeatureIndex, double testThreshold, TrainingSet &set1, TrainingSet &set2) const;
+		template<typename T> void _evaluateSplits(const CImg<T> &features, const unsigned int *testFeatureIndices, const double *testThresholds, unsigned int nCandidates, unsigned int *labelSetOccurences) const;
+		void _flushHistograms(void);
+		static double _nLogNTable[nLogNTableSize];
+		static bool _initNLogNTable(void);
+		static const bool _isNLogNTableInitialized;
 		CImg<double> *_features;
+		/*! Set instead of _features for descriptors quantized to bytes, such as SIFT. */
+		CImg<unsigned char> *_byteFeatures;
 		vector<unsigned int> *_labels;
 		vector<unsigned int> _indices;
 		unsigned int _nPoints;
@@ -47,8 +86,19 @@ namespace ercf
 		unsigned int _nLabels;
 		vector<unsigned int> _labelOccurences;
 		bool _isUnmixed;
+		shared_ptr<Bins> _bins;
+		NullableVector<CImg<unsigned int>> _histograms;
+		bool _hasHistograms;
+		const TrainingSet *_parent;
+		const TrainingSet *_sibling;
 
 	};
 
+	/*! Entropies of counts are sums of n log(n): H = log(N) - sum(n log(n)) / N, with one table lookup per count. */
+	inline double TrainingSet::nLogN(unsigned int n)
+	{
+		return (n < nLogNTableSize) ? _nLogNTable[n] : n * log((double)n);
+	}
+
 }
 
@@ -5,6 +5,8 @@
 
 #pragma once
 
+#include <winsock2.h>
+#include <afunix.h>
 #include <windows.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -17,6 +19,23 @@
 #include <tchar.h>
 #include <random>
 #include <time.h>
+#include <map>
+#include <set>
+#include <numeric>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <emmintrin.h>
+#include <intrin.h>
+#include <thread>
+#include <condition_variable>
+#include <queue>
+#include <future>
+#include <functional>
+#include <limits>
 
 #define cimg_use_openmp
 
@@ -25,23 +25,333 @@ vector<string> getFileNames(const string &query)
 	return fileNames;
 }
 
-template<>
-void loadImages<bool>(CImgList<bool> &imList, const vector<string> &fileNames)
-{	
+/*! Path of the running executable, to start workers of the same build. */
+string getExecutablePath(void)
+{
+	char path[MAX_PATH];
+	GetModuleFileNameA(NULL, path, MAX_PATH);
+	return string(path);
+}
+
+/*! Waits for process to exit, closes it and returns whether it exited with 0. */
+static bool waitForProcess(PROCESS_INFORMATION &process)
+{
+	DWORD exitCode = 1;
+	WaitForSingleObject(process.hProcess, INFINITE);
+	GetExitCodeProcess(process.hProcess, &exitCode);
+	CloseHandle(process.hProcess);
+	CloseHandle(process.hThread);
+	return exitCode == 0;
+}
+
+/*! Starts a process for each command line, at most maxNProcesses at a time if not 0, waits for all of them and returns whether they 
+ *  all exited with 0. */
+bool runProcesses(const vector<string> &commandLines, unsigned int maxNProcesses)
+{
+	vector<PROCESS_INFORMATION> processes;
+	bool isSuccessful = true;
+	for (unsigned int i = 0; i < commandLines.size(); ++i)
+	{
+		if (maxNProcesses > 0 && processes.size() >= maxNProcesses)
+		{
+			vector<HANDLE> handles;
+			for (unsigned int p = 0; p < processes.size(); ++p) handles.push_back(processes[p].hProcess);
+			DWORD p = WaitForMultipleObjects(handles.size(), handles.data(), FALSE, INFINITE) - WAIT_OBJECT_0;
+			if (p >= processes.size()) p = 0;
+			isSuccessful = waitForProcess(processes[p]) && isSuccessful;
+			processes.erase(processes.begin() + p);
+		}
+		STARTUPINFOA startupInfo;
+		memset(&startupInfo, 0, sizeof(startupInfo));
+		startupInfo.cb = sizeof(startupInfo);
+		PROCESS_INFORMATION process;
+		vector<char> commandLine(commandLines[i].begin(), commandLines[i].end());
+		commandLine.push_back('\0');
+		if (!CreateProcessA(NULL, commandLine.data(), NULL, NULL, FALSE, 0, NULL, NULL, &startupInfo, &process))
+		{
+			isSuccessful = false;
+			continue;
+		}
+		processes.push_back(process);
+	}
+	for (unsigned int p = 0; p < processes.size(); ++p) isSuccessful = waitForProcess(processes[p]) && isSuccessful;
+	return isSuccessful;
+}
+
+string escapeJson(const string &text)
+{
+	string escaped;
+	for (unsigned int i = 0; i < text.size(); ++i)
+	{
+		if (text[i] == '"' || text[i] == '\\') escaped += '\\';
+		if (text[i] != '\n' && text[i] != '\r') escaped += text[i];
+	}
+	return escaped;
+}
+
+BitMask::BitMask(void) : _width(0), _height(0), _wordsPerRow(0)
+{
+}
+
+BitMask::BitMask(unsigned int width, unsigned int height)
+{
+	assign(width, height);
+}
+
+void BitMask::assign(unsigned int width, unsigned int height)
+{
+	_width = width;
+	_height = height;
+	_wordsPerRow = (width + 31) / 32;
+	_words.assign(_wordsPerRow * height, 0);
+}
+
+/*! Keeps the pixels whose first channel lies in the darker half of its range, as the masks are drawn black on white. */
+void BitMask::load(const string &file)
+{
+	CImg<unsigned char> im(file.c_str());
+	assign(im.width(), im.height());
+	const unsigned char *data = im.data();
+	unsigned char m = data[0];
+	unsigned char M = data[0];
+	for (unsigned int i = 1; i < _width * _height; ++i)
+	{
+		m = min(m, data[i]);
+		M = max(M, data[i]);
+	}
+
+	for (unsigned int y = 0; y < _height; ++y)
+	{
+		const unsigned char *row = data + y * _width;
+		unsigned int *words = _words.data() + y * _wordsPerRow;
+		for (unsigned int x = 0; x < _width; ++x)
+		{
+			if (M == m || 2 * (unsigned int)row[x] < (unsigned int)m + M) words[x >> 5] |= 1U << (x & 31);
+		}
+	}
+}
+
+bool BitMask::operator()(unsigned int x, unsigned int y) const
+{
+	return (_words[y * _wordsPerRow + (x >> 5)] >> (x & 31)) & 1U;
+}
+
+void BitMask::set(unsigned int x, unsigned int y, bool val)
+{
+	unsigned int &word = _words[y * _wordsPerRow + (x >> 5)];
+	if (val) word |= 1U << (x & 31);
+	else word &= ~(1U << (x & 31));
+}
+
+unsigned int BitMask::width(void) const
+{
+	return _width;
+}
+
+unsigned int BitMask::height(void) const
+{
+	return _height;
+}
+
+unsigned int BitMask::area(void) const
+{
+	unsigned int n = 0;
+	for (unsigned int i = 0; i < _words.size(); ++i)
+	{
+		n += __popcnt(_words[i]);
+	}
+	return n;
+}
+
+unsigned int BitMask::_rowCount(unsigned int y, unsigned int nWords, unsigned int lastWordMask) const
+{
+	const unsigned int *words = _words.data() + y * _wordsPerRow;
+	unsigned int n = 0;
+	for (unsigned int k = 0; k + 1 < nWords; ++k)
+	{
+		n += __popcnt(words[k]);
+	}
+	return n + __popcnt(words[nWords - 1] & lastWordMask);
+}
+
+/*! Number of set pixels with x <= maxX and y <= maxY, i.e. whose distance to the right and bottom borders is at least (width - maxX, height - maxY). */
+unsigned int BitMask::countWithin(unsigned int maxX, unsigned int maxY) const
+{
+	if (_width == 0 || _height == 0) return 0;
+	maxX = min(maxX, _width - 1);
+	maxY = min(maxY, _height - 1);
+	unsigned int nWords = (maxX >> 5) + 1;
+	unsigned int lastWordMask = ((maxX & 31) == 31) ? 0xFFFFFFFF : ((1U << ((maxX & 31) + 1)) - 1);
+	unsigned int n = 0;
+	for (unsigned int y = 0; y <= maxY; ++y)
+	{
+		n += _rowCount(y, nWords, lastWordMask);
+	}
+	return n;
+}
+
+/*! Finds the n-th set pixel, in row-major order, among those counted by countWithin(maxX, maxY). */
+bool BitMask::select(unsigned int n, unsigned int maxX, unsigned int maxY, unsigned int &x, unsigned int &y) const
+{
+	if (_width == 0 || _height == 0) return false;
+	maxX = min(maxX, _width - 1);
+	maxY = min(maxY, _height - 1);
+	unsigned int nWords = (maxX >> 5) + 1;
+	unsigned int lastWordMask = ((maxX & 31) == 31) ? 0xFFFFFFFF : ((1U << ((maxX & 31) + 1)) - 1);
+	for (unsigned int row = 0; row <= maxY; ++row)
+	{
+		unsigned int rowCount = _rowCount(row, nWords, lastWordMask);
+		if (n >= rowCount)
+		{
+			n -= rowCount;
+			continue;
+		}
+
+		const unsigned int *words = _words.data() + row * _wordsPerRow;
+		for (unsigned int k = 0; k < nWords; ++k)
+		{
+			unsigned int word = (k + 1 == nWords) ? (words[k] & lastWordMask) : words[k];
+			unsigned int wordCount = __popcnt(word);
+			if (n >= wordCount)
+			{
+				n -= wordCount;
+				continue;
+			}
+			for (; n > 0; --n) word &= word - 1;
+			unsigned long bit;
+			_BitScanForward(&bit, word);
+			x = 32 * k + bit;
+			y = row;
+			return true;
+		}
+	}
+	return false;
+}
+
+void BitMask::apply(CImg<float> &image) const
+{
+	for (unsigned int c = 0; c < image.spectrum(); ++c)
+		for (unsigned int y = 0; y < _height; ++y)
+		{
+			float *row = image.data(0, y, 0, c);
+			const unsigned int *words = _words.data() + y * _wordsPerRow;
+			for (unsigned int k = 0; k < _wordsPerRow; ++k)
+			{
+				unsigned int word = words[k];
+				if (word == 0xFFFFFFFF) continue;
+				unsigned int x1 = min(32 * k + 32, _width);
+				for (unsigned int x = 32 * k; x < x1; ++x)
+				{
+					if (!((word >> (x & 31)) & 1U)) row[x] = 0.F;
+				}
+			}
+		}
+}
+
+void loadMasks(vector<BitMask> &masks, const vector<string> &fileNames)
+{
 	unsigned int nFiles = fileNames.size();
-	imList.assign(nFiles);
+	masks.resize(nFiles);
 	for (unsigned int i = 0; i < nFiles; ++i)
 	{
-		CImg<double> im(fileNames[i].c_str());
-#pragma push_macro("round")
-#undef round
-		im.channel(0).normalize(0., 1.).round();
-#pragma pop_macro("round")
-		im *= -1.;
-		im += 1.;
-		imList[i].assign(CImg<bool>(im));
+		traceScope("decode");
+		masks[i].load(fileNames[i]);
+	}
+}
+
+/*! Same conversion as CImg::RGBtoHSL (H in degrees, S and L in [0, 1]) on planar 8-bit channels, four pixels per SSE2 iteration. */
+void rgbToHsl(const unsigned char *r, const unsigned char *g, const unsigned char *b, float *h, float *s, float *l, unsigned int n)
+{
+	const __m128 scale = _mm_set1_ps(1.F / 255.F);
+	const __m128 half = _mm_set1_ps(0.5F);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.F);
+	const __m128 two = _mm_set1_ps(2.F);
+	const __m128 three = _mm_set1_ps(3.F);
+	const __m128 five = _mm_set1_ps(5.F);
+	const __m128 six = _mm_set1_ps(6.F);
+	const __m128 sixty = _mm_set1_ps(60.F);
+	const __m128i zeroI = _mm_setzero_si128();
+
+	unsigned int i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128 R = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(*(const int *)(r + i)), zeroI), zeroI)), scale);
+		__m128 G = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(*(const int *)(g + i)), zeroI), zeroI)), scale);
+		__m128 B = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(*(const int *)(b + i)), zeroI), zeroI)), scale);
+
+		__m128 m = _mm_min_ps(_mm_min_ps(R, G), B);
+		__m128 M = _mm_max_ps(_mm_max_ps(R, G), B);
+		__m128 d = _mm_sub_ps(M, m);
+		__m128 L = _mm_mul_ps(_mm_add_ps(m, M), half);
+
+		__m128 rIsMin = _mm_cmpeq_ps(R, m);
+		__m128 gIsMin = _mm_andnot_ps(rIsMin, _mm_cmpeq_ps(G, m));
+		__m128 bIsMin = _mm_andnot_ps(_mm_or_ps(rIsMin, gIsMin), _mm_castsi128_ps(_mm_set1_epi32(-1)));
+		__m128 f = _mm_or_ps(_mm_or_ps(_mm_and_ps(rIsMin, _mm_sub_ps(G, B)), _mm_and_ps(gIsMin, _mm_sub_ps(B, R))), _mm_and_ps(bIsMin, _mm_sub_ps(R, G)));
+		__m128 k = _mm_or_ps(_mm_or_ps(_mm_and_ps(rIsMin, three), _mm_and_ps(gIsMin, five)), _mm_and_ps(bIsMin, one));
+
+		__m128 H = _mm_sub_ps(k, _mm_div_ps(f, d));
+		H = _mm_sub_ps(H, _mm_and_ps(_mm_cmpge_ps(H, six), six));
+		H = _mm_mul_ps(H, sixty);
+
+		__m128 isDark = _mm_cmple_ps(_mm_mul_ps(two, L), one);
+		__m128 S = _mm_or_ps(_mm_and_ps(isDark, _mm_div_ps(d, _mm_add_ps(M, m))), _mm_andnot_ps(isDark, _mm_div_ps(d, _mm_sub_ps(_mm_sub_ps(two, M), m))));
+
+		__m128 isGrey = _mm_cmpeq_ps(d, zero);
+		_mm_storeu_ps(h + i, _mm_andnot_ps(isGrey, H));
+		_mm_storeu_ps(s + i, _mm_andnot_ps(isGrey, S));
+		_mm_storeu_ps(l + i, L);
+	}
+
+	for (; i < n; ++i)
+	{
+		float R = r[i] / 255.F;
+		float G = g[i] / 255.F;
+		float B = b[i] / 255.F;
+		float m = min(min(R, G), B);
+		float M = max(max(R, G), B);
+		float L = (m + M) / 2;
+		float H = 0.F;
+		float S = 0.F;
+		if (M != m)
+		{
+			float f = (R == m) ? (G - B) : ((G == m) ? (B - R) : (R - G));
+			float k = (R == m) ? 3.F : ((G == m) ? 5.F : 1.F);
+			H = k - f / (M - m);
+			if (H >= 6.F) H -= 6.F;
+			H *= 60.F;
+			S = (2 * L <= 1.F) ? ((M - m) / (M + m)) : ((M - m) / (2 - M - m));
+		}
+		h[i] = H;
+		s[i] = S;
+		l[i] = L;
 	}
+}
+
+/*! Converts an 8-bit RGB (or gray) image to HSL with rgbToHsl. */
+void rgbToHslImage(const CImg<unsigned char> &rgb, CImg<float> &hsl)
+{
+	unsigned int n = rgb.width() * rgb.height();
+	const unsigned char *r = rgb.data();
+	const unsigned char *g = (rgb.spectrum() >= 3) ? rgb.data(0, 0, 0, 1) : r;
+	const unsigned char *b = (rgb.spectrum() >= 3) ? rgb.data(0, 0, 0, 2) : r;
+
+	hsl.assign(rgb.width(), rgb.height(), 1, 3);
+	rgbToHsl(r, g, b, hsl.data(0, 0, 0, 0), hsl.data(0, 0, 0, 1), hsl.data(0, 0, 0, 2), n);
+}
 
+void loadHslImages(CImgList<float> &imList, const vector<string> &fileNames)
+{
+	unsigned int nFiles = fileNames.size();
+	imList.assign(nFiles);
+	CImg<unsigned char> rgb;
+	for (unsigned int i = 0; i < nFiles; ++i)
+	{
+		traceScope("decode");
+		rgb.load(fileNames[i].c_str());
+		rgbToHslImage(rgb, imList[i]);
+	}
 }
 
 Plot::Plot(void)
@@ -87,7 +397,7 @@ void Plot::operator()(void) const
 	_image.display();
 }
 
-Timer::Timer(void) : _start(clock()), _elapsed(0.)
+Timer::Timer(void) : _start(Trace::now()), _elapsed(0.)
 {
 }
 
@@ -98,13 +408,13 @@ double Timer::last(void) const
 
 void Timer::begin(void)
 {
-	_start = clock();
+	_start = Trace::now();
 	_elapsed = 0.;
 }
 
 double Timer::end(void)
 {
-	_elapsed = (double)clock() - _start;
-	_elapsed /= CLOCKS_PER_SEC;
+	_elapsed = (double)(Trace::now() - _start);
+	_elapsed /= 1e9;
 	return _elapsed;
 }
@@ -2,6 +2,7 @@
 
 #pragma once
 #include "stdafx.h"
+#include "Trace.h"
 
 template<typename T, class Distribution>
 class Random
@@ -29,6 +30,7 @@ public:
 	}
 	void assign(T min, T max, T seed = 999)
 	{
+		if (_generator != NULL) delete _generator;
 		_min = min;
 		_max = max;
 		_seed = seed;
@@ -44,8 +46,22 @@ public:
 	}
 	static T Default(void)
 	{
-		static Random<T, Distribution> random((T)0, (T)1);
-		return random();
+		return _getDefault()();
+	}
+	/*! Reseeds the generator of Default on the calling thread only, so that the draws that follow can be replayed. */
+	static void seedDefault(T seed)
+	{
+		_getDefault().assign((T)0, (T)1, seed);
+	}
+private:
+	/*! Each thread has its own generator, seeded with 999 plus the rank of its first draw, so that concurrent images or requests 
+	 *  do not sample the same sequence. The first thread to draw keeps the seed 999. Which seed the others get depends on the 
+	 *  scheduling, so work that must not, like the tiles of TiledExtractor, samples from its own generators. */
+	static Random<T, Distribution> &_getDefault(void)
+	{
+		static atomic<unsigned int> nThreads(0);
+		thread_local Random<T, Distribution> random((T)0, (T)1, (T)999 + (T)nThreads++);
+		return random;
 	}
 };
 
@@ -53,6 +69,9 @@ typedef Random<int, uniform_int_distribution<int>> RandomInt;
 typedef Random<double, uniform_real_distribution<double>> RandomDouble;
 
 vector<string> getFileNames(const string &query);
+string escapeJson(const string &text);
+string getExecutablePath(void);
+bool runProcesses(const vector<string> &commandLines, unsigned int maxNProcesses = 0);
 
 template<typename T>
 void loadImages(CImgList<T> &imList, const vector<string> &fileNames)
@@ -61,12 +80,14 @@ void loadImages(CImgList<T> &imList, const vector<string> &fileNames)
 	imList.assign(nFiles);
 	for (unsigned int i = 0; i < nFiles; ++i)
 	{
+		traceScope("decode");
 		imList.at(i).assign(CImg<T>(fileNames.at(i).c_str()).RGBtoHSL());
 	}
 }
 
-template<>
-void loadImages<bool>(CImgList<bool> &imList, const vector<string> &fileNames);
+void rgbToHsl(const unsigned char *r, const unsigned char *g, const unsigned char *b, float *h, float *s, float *l, unsigned int n);
+void rgbToHslImage(const CImg<unsigned char> &rgb, CImg<float> &hsl);
+void loadHslImages(CImgList<float> &imList, const vector<string> &fileNames);
 
 template<typename T>
 void printMatrix(CImg<T> &matrix)
@@ -81,6 +102,33 @@ void printMatrix(CImg<T> &matrix)
 	}
 }
 
+/*! Binary image packed 32 pixels per word, one row of words per image line. */
+class BitMask
+{
+public:
+	BitMask(void);
+	BitMask(unsigned int width, unsigned int height);
+	void assign(unsigned int width, unsigned int height);
+	void load(const string &file);
+	bool operator()(unsigned int x, unsigned int y) const;
+	void set(unsigned int x, unsigned int y, bool val = true);
+	unsigned int width(void) const;
+	unsigned int height(void) const;
+	unsigned int area(void) const;
+	unsigned int countWithin(unsigned int maxX, unsigned int maxY) const;
+	bool select(unsigned int n, unsigned int maxX, unsigned int maxY, unsigned int &x, unsigned int &y) const;
+	void apply(CImg<float> &image) const;
+
+private:
+	unsigned int _rowCount(unsigned int y, unsigned int nWords, unsigned int lastWordMask) const;
+	unsigned int _width;
+	unsigned int _height;
+	unsigned int _wordsPerRow;
+	vector<unsigned int> _words;
+};
+
+void loadMasks(vector<BitMask> &masks, const vector<string> &fileNames);
+
 class Plot
 {
 private:
@@ -97,6 +145,7 @@ public:
 	void operator()(void) const;
 };
 
+/*! Wall-clock stopwatch on the monotonic clock used by Trace. */
 class Timer 
 {
 public:
@@ -106,7 +155,7 @@ public:
 	double end(void);
 
 private:
-	clock_t _start;
+	long long _start;
 	double _elapsed;
 };
 
@@ -131,7 +180,7 @@ public:
 		_data.assign(size, val);
 		_nullData.assign(size, isNull);
 	}
-	bool isNull(unsigned int index)
+	bool isNull(unsigned int index) const
 	{
 		return _nullData[index];
 	}
@@ -152,10 +201,70 @@ public:
 	{
 		return _data[i];
 	}
+	const T &operator[](unsigned int i) const
+	{
+		return _data[i];
+	}
 };
 
 
 
+/*! Slab allocator addressed by index. Elements are placement-constructed by the caller into 
+ *  contiguous slabs and are never destroyed one by one: clear() releases all of them at once 
+ *  and keeps the slabs for reuse, so T must not own resources. Elements cannot be freed one by 
+ *  one either: a pruned ErcTree copies its remaining nodes into a new arena and frees the old one. */
+template<typename T>
+class Arena
+{
+private:
+	static const unsigned int _slabBits = 10;
+	static const unsigned int _slabSize = 1 << _slabBits;
+	vector<T *> _slabs;
+	unsigned int _size;
+
+	Arena(const Arena &arena);
+	Arena &operator=(const Arena &arena);
+
+public:
+	Arena(void) : _size(0)
+	{
+	}
+
+	~Arena(void)
+	{
+		for (unsigned int i = 0; i < _slabs.size(); ++i)
+		{
+			::operator delete(_slabs[i]);
+		}
+	}
+
+	unsigned int allocate(void)
+	{
+		if (_size == _slabs.size() * _slabSize) _slabs.push_back(static_cast<T *>(::operator new(_slabSize * sizeof(T))));
+		return _size++;
+	}
+
+	T *operator[](unsigned int i) const
+	{
+		return _slabs[i >> _slabBits] + (i & (_slabSize - 1));
+	}
+
+	void clear(void)
+	{
+		_size = 0;
+	}
+
+	unsigned int size(void) const
+	{
+		return _size;
+	}
+
+	unsigned int capacity(void) const
+	{
+		return _slabs.size() * _slabSize;
+	}
+};
+
 template<typename K, typename V>
 class AssociativeSortedList
 {